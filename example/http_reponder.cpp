@@ -1,65 +1,67 @@
 #include <iostream>
 #include <memory>
 #include <string>
-#include <fstream>
-#include <sstream>
-#include <stdexcept>
+#include <string_view>
 #include "pipef.h" // Assuming this is the custom library for pipeline processing
+#include "pipef/uv.h"
 
-// Function to read an HTML file from disk
-std::string read_html_file(const std::string& file_path) {
-    std::ifstream file(file_path);
-    if (!file.is_open()) {
-        throw std::runtime_error("Unable to open file: " + file_path);
-    }
+// Parts of an HTTP request, all slices of the receive buffer
+struct http_request {
+    pipef::bytes method;
+    pipef::bytes path;
+    pipef::bytes headers;
+    pipef::bytes body;
+};
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
-}
+// Splits a request without copying it; returns false if it is incomplete
+bool parse_request(const pipef::bytes& raw, http_request& request) {
+    std::string_view text = raw.view();
+    auto line_end = text.find("\r\n");
+    auto headers_end = text.find("\r\n\r\n");
+    if (line_end == std::string_view::npos || headers_end == std::string_view::npos) return false;
 
-// Pipeline step: Process HTTP request
-std::string handle_request(const std::string& request) {
-    std::cout << "Received HTTP request:\n" << request << std::endl;
-    return request; // Can be extended to parse or process the request further
-}
+    std::string_view line = text.substr(0, line_end);
+    auto method_end = line.find(' ');
+    auto path_end = line.find(' ', method_end + 1);
+    if (method_end == std::string_view::npos || path_end == std::string_view::npos) return false;
 
-// Pipeline step: Generate an HTTP response
-std::string generate_response(const std::string& html_content) {
-    std::ostringstream response;
-    response << "HTTP/1.1 200 OK\r\n"
-             << "Content-Type: text/html\r\n"
-             << "Content-Length: " << html_content.size() << "\r\n"
-             << "Connection: close\r\n\r\n"
-             << html_content;
-    return response.str();
+    request.method = raw.slice(0, method_end);
+    request.path = raw.slice(method_end + 1, path_end - method_end - 1);
+    request.headers = raw.slice(line_end + 2, headers_end - line_end - 2);
+    request.body = raw.slice(headers_end + 4);
+    return true;
 }
 
-// Function to send an HTTP response
-void send_response(std::shared_ptr<tcp::socket> socket, const std::string& response) {
-    try {
-        boost::asio::write(*socket, boost::asio::buffer(response));
-        socket->close();
-    } catch (const std::exception& e) {
-        std::cerr << "Error sending response: " << e.what() << std::endl;
+// Pipeline step: Process HTTP request; parses the received data in place
+void handle_request(const pipef::bytes& raw) {
+    http_request request;
+    if (!parse_request(raw, request)) {
+        std::cout << "Received incomplete HTTP request (" << raw.size() << " bytes)" << std::endl;
+        return;
     }
+    std::cout << "Received HTTP request: " << request.method.view() << " " << request.path.view() << "\n"
+              << request.headers.view() << std::endl;
+    // Can be extended to route on the path or read the body
 }
 
 int main() {
     try {
-        const std::string html_file = "index.html"; // Path to the HTML file
+        const std::string web_root = ".";           // Directory served, with index.html for "/"
         const unsigned short port = 8080;          // Port to listen on
 
-        // Read the HTML content from file
-        const std::string html_content = read_html_file(html_file);
-
         // Create engine and pipeline components
         auto engine = pipef::engine::create();
-        auto request_source = engine->create<tcp_input_source>(port);
-        auto request_processor = engine->create<transformer<std::string>>(handle_request);
-        auto response_generator = engine->create<transformer<std::string>>(
-            [html_content](const std::string&) { return generate_response(html_content); });
-        auto response_sender = engine->create<tcp_output_sink>();
+        auto request_source = engine->create<pipef::tcp_input_source>(port);
+        request_source->framed(pipef::http_request_size); // one item per pipelined request
+        auto request_processor = engine->create<pipef::mutator<pipef::tcp_message>>(
+            [](pipef::tcp_message& msg) {
+                pipef::bytes raw(std::move(msg.data));
+                handle_request(raw);
+                msg.data = std::move(raw).release(); // no copy: the parsed slices are gone
+            });
+        // Pipeline step: Answer from pre-serialized responses, refreshed when the files change
+        auto response_generator = engine->create<pipef::response_cache>(web_root);
+        auto response_sender = engine->create<pipef::tcp_output_sink>();
 
         // Build the pipeline
         *request_source
@@ -68,9 +70,11 @@ int main() {
             | *response_sender;
 
         // Run the pipeline
-        constexpr int loop_count = INFINITE; // Unlimited loop count
+        constexpr int loop_count = pipef::INFINITE; // Unlimited loop count
         constexpr int duration_ms = 10000;  // Duration in milliseconds
-        engine->run(loop_count, duration_ms);
+        // Every stage runs on the libuv loop thread, which also waits on the sockets
+        pipef::uv_driver driver(uv_default_loop());
+        engine->run_on(driver, loop_count, duration_ms);
 
         std::cout << "HTTP server is running on port " << port << "..." << std::endl;
     } catch (const std::exception& e) {
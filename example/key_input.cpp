@@ -1,7 +1,9 @@
+#include <cstdlib>
+#include <functional>
 #include <iostream>
-#include <memory>
+#include <map>
 #include <string>
-#include <functional>
+#include "pipef.h"
 
 // Function to run CLI commands
 void run_cli_cmd(const std::string& command) {
@@ -20,33 +22,46 @@ void history_command(const std::string&) {
 }
 
 // Function to display help information
-std::string generate_help_string(data_uptr data) {
-    return "Help string... " + data->to_string();
+std::string generate_help_string(const std::string& line) {
+    return "Help string... " + line;
 }
 
 int main() {
     try {
         // Create engine and pipeline components
         auto engine = pipef::engine::create();
-        auto src = engine->create<key_input_src>();
-        auto help_filter = engine->create<character_filter>();
-        auto command_mapper = engine->create<command_map>();
-        auto sink = engine->create<print_sink>();
+        auto src = engine->create<pipef::key_input_src>();
+
+        // Commands, looked up by the first word of a line
+        std::map<std::string, std::function<void(const std::string&)>> commands = {
+            {"history", history_command},
+            {"quit", [](const std::string&) { quit_program(); }},
+            {"run", run_cli_cmd},
+        };
+
+        // Echoes every line
+        auto echo = engine->create<pipef::sink<std::string>>([](const std::string& line) {
+            std::cout << line << std::endl;
+        });
 
-        // Setup pipeline
-        src | sink[stdout];
+        // Prints the help text for "help"
+        auto help = engine->create<pipef::sink<std::string>>([](const std::string& line) {
+            if (line == "help") std::cout << generate_help_string(line) << std::endl;
+        });
 
-        src 
-            | help_filter["help"]
-            | map(generate_help_string) 
-            | sink[stdout];
+        // Runs the command a line starts with, if any
+        auto command_mapper = engine->create<pipef::sink<std::string>>([&](const std::string& line) {
+            auto it = commands.find(line.substr(0, line.find(' ')));
+            if (it != commands.end()) it->second(line);
+        });
 
-        src | command_mapper["history"].set(history_command);
-        src | command_mapper["quit"].set(quit_program);
-        src | command_mapper["run"].set(run_cli_cmd);
+        // Setup pipeline; every line goes to all three sinks
+        src | echo;
+        src | help;
+        src | command_mapper;
 
         // Run the engine
-        engine->run(INFINITE /* loop count */, 10000 /* duration ms */);
+        engine->run(pipef::INFINITE /* loop count */, 10000 /* duration ms */);
 
         std::cout << "End of program." << std::endl;
 
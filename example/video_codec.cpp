@@ -1,8 +1,15 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <vector>
-#include "pipef.h" // Hypothetical pipeline framework
+#include "pipef.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
 
 // Constants
 const int WIDTH = 1280;
@@ -54,19 +61,20 @@ AVFormatContext* initialize_output_format(const char* output_mp4, AVCodecContext
     return fmt_ctx;
 }
 
-// Function to read a single YUV frame
-std::shared_ptr<std::vector<uint8_t>> read_yuv_frame(std::ifstream& yuv_file) {
-    const size_t frame_size = WIDTH * HEIGHT * 3 / 2; // YUV420P
-    auto frame_data = std::make_shared<std::vector<uint8_t>>(frame_size);
+const size_t FRAME_SIZE = WIDTH * HEIGHT * 3 / 2; // YUV420P
+
+// Function to read a single YUV frame into a recycled buffer; std::nullopt at the end of the file
+std::optional<pipef::frame_ptr> read_yuv_frame(pipef::frame_pool& pool, std::ifstream& yuv_file) {
+    auto frame_data = pool.acquire();
 
-    if (yuv_file.read(reinterpret_cast<char*>(frame_data->data()), frame_size)) {
+    if (yuv_file.read(reinterpret_cast<char*>(frame_data->data()), frame_data->size())) {
         return frame_data;
     }
-    return nullptr;
+    return std::nullopt;
 }
 
 // Function to encode a YUV frame
-std::shared_ptr<AVPacket> encode_frame(AVCodecContext* codec_ctx, std::shared_ptr<std::vector<uint8_t>> frame_data) {
+pipef::envelope<AVPacket> encode_frame(AVCodecContext* codec_ctx, pipef::frame_ptr frame_data) {
     if (!frame_data) return nullptr;
 
     AVFrame* frame = av_frame_alloc();
@@ -84,7 +92,7 @@ std::shared_ptr<AVPacket> encode_frame(AVCodecContext* codec_ctx, std::shared_pt
         return nullptr;
     }
 
-    auto packet = std::make_shared<AVPacket>();
+    auto packet = pipef::make_envelope<AVPacket>();
     av_init_packet(packet.get());
     packet->data = nullptr;
     packet->size = 0;
@@ -111,8 +119,10 @@ int main() {
     const char* input_yuv = "input.yuv";
     const char* output_mp4 = "output.mp4";
 
-    // Initialize FFmpeg
+#if LIBAVFORMAT_VERSION_MAJOR < 58
+    // Initialize FFmpeg; newer versions register everything on their own
     av_register_all();
+#endif
 
     try {
         // Open YUV file
@@ -126,33 +136,36 @@ int main() {
         AVStream* video_stream = nullptr;
         AVFormatContext* fmt_ctx = initialize_output_format(output_mp4, codec_ctx, video_stream);
 
-        // Create pipeline components
-        auto engine = pipef::engine::create();
+        // Create pipeline components; one worker each for reading, encoding and muxing
+        auto engine = pipef::engine::create(3);
+
+        // Raw frames return to the pool once the encoder is done with them
+        auto frames = pipef::frame_pool::create(FRAME_SIZE, true /* huge pages */);
 
-        auto file_reader = engine->create<source<std::shared_ptr<std::vector<uint8_t>>>>(
-            [&]() -> std::shared_ptr<std::vector<uint8_t>> {
-                return read_yuv_frame(yuv_file);
+        auto file_reader = engine->create<pipef::source<pipef::frame_ptr>>(
+            [&]() -> std::optional<pipef::frame_ptr> {
+                return read_yuv_frame(*frames, yuv_file);
             });
 
-        auto encoder = engine->create<transformer<std::shared_ptr<std::vector<uint8_t>>, std::shared_ptr<AVPacket>>>(
-            [&](std::shared_ptr<std::vector<uint8_t>> frame_data) -> std::shared_ptr<AVPacket> {
+        auto encoder = engine->create<pipef::transformer<pipef::frame_ptr, pipef::envelope<AVPacket>>>(
+            [&](pipef::frame_ptr frame_data) -> pipef::envelope<AVPacket> {
                 return encode_frame(codec_ctx, frame_data);
             });
 
-        auto file_writer = engine->create<sink<std::shared_ptr<AVPacket>>>(
-            [&](std::shared_ptr<AVPacket> packet) {
+        auto file_writer = engine->create<pipef::sink<pipef::envelope<AVPacket>>>(
+            [&](pipef::envelope<AVPacket> packet) {
                 if (packet) write_packet(fmt_ctx, packet.get(), video_stream);
             });
 
-        // Build and run the pipeline
-        file_reader | encoder | file_writer;
-        engine->run(INFINITE, 10000);
+        // Build and run the pipeline; at most 8 raw frames wait for the encoder
+        file_reader | pipef::bounded(8, pipef::overflow::block) | encoder | file_writer;
+        engine->run(pipef::INFINITE, 10000);
 
         // Finalize
         av_write_trailer(fmt_ctx);
         avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
-        avio_closep(&fmt_ctx->pb);
+        if (!(fmt_ctx->oformat->flags & AVFMT_NOFILE)) avio_closep(&fmt_ctx->pb);
+        avformat_free_context(fmt_ctx);
 
         std::cout << "Encoding completed: " << output_mp4 << std::endl;
     } catch (const std::exception& ex) {
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "pipef/scheduler.h"
+#include "pipef/arena.h"
+#include "pipef/callable.h"
+#include "pipef/function.h"
+#include "pipef/spill.h"
+#include "pipef/message.h"
+#include "pipef/pool.h"
+#include "pipef/frame_pool.h"
+#include "pipef/envelope.h"
+#include "pipef/bytes.h"
+#include "pipef/coroutine.h"
+#include "pipef/reactor.h"
+#include "pipef/channel.h"
+#include "pipef/stage.h"
+#include "pipef/batch.h"
+#include "pipef/engine.h"
+#include "pipef/io.h"
+#include "pipef/tcp.h"
+#include "pipef/http.h"
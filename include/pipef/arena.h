@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace pipef {
+
+// Scratch memory for stage callables declared with a trailing std::pmr::memory_resource* parameter.
+// Each worker thread has one monotonic arena; everything a callable allocates from it is
+// released in one go when the invocation returns, so short-lived temporaries never reach
+// the global allocator. Nothing allocated from the arena may outlive the call.
+class arena_scope {
+public:
+    static constexpr std::size_t buffer_size = 64 * 1024;
+
+    arena_scope() : arena_(local()) { ++arena_.depth; }
+
+    // Only the outermost scope on a thread rewinds the arena
+    ~arena_scope() {
+        if (--arena_.depth == 0) arena_.resource.release();
+    }
+
+    arena_scope(const arena_scope&) = delete;
+    arena_scope& operator=(const arena_scope&) = delete;
+
+    std::pmr::memory_resource* resource() { return &arena_.resource; }
+
+private:
+    struct thread_arena {
+        // Rewinding keeps the initial buffer; only overflow beyond it goes back to the heap
+        std::unique_ptr<std::byte[]> buffer{new std::byte[buffer_size]};
+        std::pmr::monotonic_buffer_resource resource{buffer.get(), buffer_size};
+        int depth = 0;
+    };
+
+    static thread_arena& local() {
+        thread_local thread_arena arena;
+        return arena;
+    }
+
+    thread_arena& arena_;
+};
+
+} // namespace pipef
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "stage.h"
+
+namespace pipef {
+
+// Adaptive batch size: doubles while the input backlog is at least one batch deep,
+// halves once it drops below a quarter batch, so deep queues are drained in large
+// batches and shallow ones keep per-item latency.
+// Batched stages count each batch as one unit of the scheduler's step budget, so a
+// batch may grow past scheduler::task_budget items up to the stage's max_batch.
+class batch_sizer {
+public:
+    static constexpr std::size_t default_max = 256;
+
+    explicit batch_sizer(std::size_t max = default_max) : max_(max == 0 ? 1 : max) {}
+
+    std::size_t size() const { return size_; }
+
+    void update(std::size_t backlog) {
+        if (backlog >= size_ && size_ < max_) {
+            size_ = std::min(size_ * 2, max_);
+        } else if (backlog < size_ / 4) {
+            size_ = std::max<std::size_t>(size_ / 2, 1);
+        }
+    }
+
+private:
+    std::size_t max_;
+    std::size_t size_ = 1;
+};
+
+// Output buffer of a batched stage: results wait here until every downstream link has room
+template <typename T>
+class batch_output : public output_port<T> {
+protected:
+    // Emits buffered results; returns false if a downstream link filled up first
+    bool flush() {
+        while (flushed_ < pending_.size() && this->writable()) {
+            this->emit(std::move(pending_[flushed_++]));
+        }
+        if (flushed_ < pending_.size()) return false;
+        pending_.clear();
+        flushed_ = 0;
+        return true;
+    }
+
+    bool has_pending() const { return flushed_ < pending_.size(); }
+
+    std::vector<T> pending_;
+    std::size_t flushed_ = 0;
+};
+
+// Batched source: `fn` fills up to span.size() items and returns how many it produced,
+// 0 meaning end of stream. The span grows while every batch comes back full.
+template <typename T>
+class source<std::span<T>> : public node, public batch_output<T> {
+public:
+    using output_type = T;
+    using function_type = inline_function<std::size_t(std::span<T>)>;
+
+    explicit source(function_type fn, std::size_t max_batch = batch_sizer::default_max)
+        : fn_(std::move(fn)), sizer_(max_batch), buffer_(max_batch == 0 ? 1 : max_batch) {}
+
+protected:
+    void start(int loop_count) override {
+        remaining_ = loop_count;
+        exhausted_ = false;
+    }
+
+    bool ready() const override {
+        if (this->has_pending()) return this->writable();
+        return !exhausted_ && remaining_ != 0 && this->writable() && within_budget();
+    }
+
+    void step(std::size_t budget) override {
+        for (; budget > 0 && this->flush() && !exhausted_ && remaining_ != 0 && within_budget(); --budget) {
+            std::size_t want = sizer_.size();
+            if (remaining_ > 0) want = std::min<std::size_t>(want, remaining_);
+
+            std::size_t n = std::min(fn_(std::span<T>(buffer_.data(), want)), want);
+            if (n == 0) {
+                exhausted_ = true;
+                break;
+            }
+            if (remaining_ > 0) remaining_ -= static_cast<int>(n);
+            sizer_.update(n == want ? want : 0);
+
+            std::move(buffer_.begin(), buffer_.begin() + n, std::back_inserter(this->pending_));
+        }
+        this->flush();
+    }
+
+private:
+    function_type fn_;
+    batch_sizer sizer_;
+    std::vector<T> buffer_;
+    int remaining_ = 0;
+    bool exhausted_ = true;
+};
+
+// Batched transformer: `fn` maps a span of inputs to any number of outputs.
+// The engine picks the span length from the input backlog (see batch_sizer).
+template <typename In, typename Out>
+class transformer<std::span<In>, std::vector<Out>> : public node, public input_port<In>, public batch_output<Out> {
+public:
+    using function_type = inline_function<std::vector<Out>(std::span<In>)>;
+
+    explicit transformer(function_type fn, std::size_t max_batch = batch_sizer::default_max)
+        : fn_(std::move(fn)), sizer_(max_batch) {}
+
+protected:
+    void fuse() override { this->fuse_outputs(); }
+    void adopt_outputs(node* head) override { this->adopt_outputs_from(head); }
+    void place_inputs(std::size_t numa_node) override { this->place_input_links(numa_node); }
+
+    bool ready() const override {
+        return (this->has_pending() || this->readable()) && this->writable();
+    }
+
+    void step(std::size_t budget) override {
+        for (; budget > 0 && this->flush(); --budget) {
+            batch_.clear();
+            if (this->receive_batch(batch_, sizer_.size()) == 0) break;
+            sizer_.update(this->backlog());
+
+            this->pending_ = fn_(std::span<In>(batch_));
+        }
+        this->flush();
+        this->release_inputs();
+    }
+
+private:
+    function_type fn_;
+    batch_sizer sizer_;
+    std::vector<In> batch_;
+};
+
+// Batched sink: `fn` consumes a span of items at a time
+template <typename T>
+class sink<std::span<T>> : public node, public input_port<T> {
+public:
+    using function_type = inline_function<void(std::span<T>)>;
+
+    explicit sink(function_type fn, std::size_t max_batch = batch_sizer::default_max)
+        : fn_(std::move(fn)), sizer_(max_batch) {}
+
+protected:
+    void place_inputs(std::size_t numa_node) override { this->place_input_links(numa_node); }
+    bool ready() const override { return this->readable(); }
+
+    void step(std::size_t budget) override {
+        for (; budget > 0; --budget) {
+            batch_.clear();
+            if (this->receive_batch(batch_, sizer_.size()) == 0) break;
+            sizer_.update(this->backlog());
+
+            fn_(std::span<T>(batch_));
+        }
+        this->release_inputs();
+    }
+
+private:
+    function_type fn_;
+    batch_sizer sizer_;
+    std::vector<T> batch_;
+};
+
+} // namespace pipef
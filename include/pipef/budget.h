@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "scheduler.h"
+
+namespace pipef {
+
+// Bytes an item accounts for while it sits in a link.
+// Specialize for payload types whose heap footprint differs from sizeof.
+template <typename T>
+struct payload_size {
+    std::size_t operator()(const T&) const { return sizeof(T); }
+};
+
+template <typename C, typename Tr, typename A>
+struct payload_size<std::basic_string<C, Tr, A>> {
+    std::size_t operator()(const std::basic_string<C, Tr, A>& s) const {
+        return sizeof(s) + s.capacity() * sizeof(C);
+    }
+};
+
+template <typename U, typename A>
+struct payload_size<std::vector<U, A>> {
+    std::size_t operator()(const std::vector<U, A>& v) const { return sizeof(v) + v.capacity() * sizeof(U); }
+};
+
+template <typename U>
+struct payload_size<std::shared_ptr<U>> {
+    std::size_t operator()(const std::shared_ptr<U>& p) const {
+        return sizeof(p) + (p ? payload_size<std::remove_cv_t<U>>()(*p) : 0);
+    }
+};
+
+// Engine-wide cap on the bytes of items queued in links.
+// Links charge an item when it is pushed and credit it when it is popped or dropped;
+// sources stop producing while the total is at or above the limit and are notified
+// once consumers bring it back under.
+class memory_budget {
+public:
+    explicit memory_budget(std::size_t limit) : limit_(limit) {}
+
+    std::size_t limit() const { return limit_; }
+    std::size_t in_flight() const { return used_.load(std::memory_order_relaxed); }
+
+    void charge(std::size_t bytes) { used_.fetch_add(bytes, std::memory_order_relaxed); }
+
+    void credit(std::size_t bytes) {
+        std::size_t now = used_.fetch_sub(bytes, std::memory_order_seq_cst) - bytes;
+        if (now < limit_ && waiting_.load(std::memory_order_seq_cst)
+            && waiting_.exchange(false, std::memory_order_acq_rel)) {
+            std::vector<node*> waiters;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                waiters.swap(waiters_);
+            }
+            for (node* n : waiters) n->notify();
+        }
+    }
+
+    // Whether `producer` may add more items; if not, it is notified once there is room again
+    bool admit(node* producer) {
+        if (used_.load(std::memory_order_relaxed) < limit_) return true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (std::find(waiters_.begin(), waiters_.end(), producer) == waiters_.end()) {
+                waiters_.push_back(producer);
+            }
+        }
+        waiting_.store(true, std::memory_order_seq_cst);
+        return used_.load(std::memory_order_seq_cst) < limit_;
+    }
+
+    // Called once a run is over, so that items released later (e.g. with their stages) wake no
+    // one; producers still held back ask again when the next run starts them
+    void forget_waiters() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiters_.clear();
+        waiting_.store(false, std::memory_order_relaxed);
+    }
+
+private:
+    const std::size_t limit_;
+    alignas(64) std::atomic<std::size_t> used_{0};
+    std::atomic<bool> waiting_{false};
+    std::mutex mutex_;
+    std::vector<node*> waiters_;
+};
+
+inline bool node::within_budget() const {
+    return !budget_ || budget_->admit(const_cast<node*>(this));
+}
+
+} // namespace pipef
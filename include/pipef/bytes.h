@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "budget.h"
+#include "envelope.h"
+#include "spill.h"
+
+namespace pipef {
+
+// Immutable, reference-counted byte buffer with O(1) slicing, for zero-copy parsing.
+// A bytes adopts a std::string without copying it (e.g. the data of a tcp_message) and
+// every slice shares that buffer, so a request can be split into method, path, headers
+// and body that all point into the original receive buffer. The buffer is freed with
+// the last slice. Like envelope, which holds the buffer, a bytes fans out to several
+// links as one reference per branch.
+class bytes {
+public:
+    static constexpr std::size_t npos = std::string_view::npos;
+
+    bytes() noexcept = default;
+
+    explicit bytes(std::string s) {
+        if (s.empty()) return;
+        owner_ = make_envelope<std::string>(std::move(s));
+        data_ = owner_->data();
+        size_ = owner_->size();
+    }
+
+    const char* data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    const char* begin() const noexcept { return data_; }
+    const char* end() const noexcept { return data_ + size_; }
+    char operator[](std::size_t i) const noexcept { return data_[i]; }
+
+    std::string_view view() const noexcept { return {data_, size_}; }
+    operator std::string_view() const noexcept { return view(); }
+
+    // Copies the bytes out
+    std::string str() const { return std::string(data_, size_); }
+
+    // Gives the bytes back as a string: the adopted one, without a copy, if this is its only
+    // reference and spans all of it (e.g. once the slices parsed from it are gone), else a copy
+    std::string release() && {
+        bool whole = owner_.unique() && data_ == owner_->data() && size_ == owner_->size();
+        std::string s = whole ? std::move(*owner_) : str();
+        *this = bytes();
+        return s;
+    }
+
+    // The bytes at [offset, offset + length), sharing this buffer; like substr, `length` is clamped
+    bytes slice(std::size_t offset, std::size_t length = npos) const {
+        if (offset > size_) throw std::out_of_range("pipef: bytes::slice offset past the end");
+        return bytes(owner_, data_ + offset, std::min(length, size_ - offset));
+    }
+
+    // The bytes `part` refers to, which must be a view into this buffer (e.g. found with view().find)
+    bytes slice(std::string_view part) const {
+        if (part.empty()) return {};
+        if (part.data() < data_ || part.data() + part.size() > data_ + size_) {
+            throw std::out_of_range("pipef: bytes::slice of a view outside the buffer");
+        }
+        return bytes(owner_, part.data(), part.size());
+    }
+
+    // Size of the whole buffer kept alive by this slice
+    std::size_t buffer_size() const noexcept { return owner_ ? owner_->capacity() : 0; }
+
+    friend bool operator==(const bytes& a, std::string_view b) noexcept { return a.view() == b; }
+
+private:
+    bytes(const envelope<std::string>& owner, const char* data, std::size_t size)
+        : owner_(owner), data_(data), size_(size) {}
+
+    envelope<std::string> owner_;
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+template <>
+struct is_envelope<bytes> : std::true_type {};
+
+template <>
+struct payload_size<bytes> {
+    std::size_t operator()(const bytes& b) const { return sizeof(b) + b.buffer_size(); }
+};
+
+template <>
+struct spill_codec<bytes> {
+    static void encode(bytes&& b, std::string& out) { out.append(b.view()); }
+    static bytes decode(std::string_view in) { return bytes(std::string(in)); }
+};
+
+} // namespace pipef
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <type_traits>
+
+namespace pipef {
+
+namespace detail {
+
+template <typename Sig>
+struct signature_arg { using type = void; };
+
+template <typename R, typename A, typename... Rest>
+struct signature_arg<R (*)(A, Rest...)> { using type = A; };
+
+template <typename R, typename C, typename A, typename... Rest>
+struct signature_arg<R (C::*)(A, Rest...)> { using type = A; };
+
+template <typename R, typename C, typename A, typename... Rest>
+struct signature_arg<R (C::*)(A, Rest...) const> { using type = A; };
+
+template <typename F, typename = void>
+struct callable_arg : signature_arg<std::decay_t<F>> {};
+
+template <typename F>
+struct callable_arg<F, std::void_t<decltype(&std::decay_t<F>::operator())>>
+    : signature_arg<decltype(&std::decay_t<F>::operator())> {};
+
+} // namespace detail
+
+// Declared type of a callable's first parameter, or void for overloaded and generic callables
+template <typename F>
+using callable_arg_t = typename detail::callable_arg<F>::type;
+
+// Whether a stage callable only reads its input, so it can be handed a shared fan-out slot without a copy
+template <typename F, typename T>
+inline constexpr bool reads_by_ref = std::is_same_v<callable_arg_t<F>, const T&>;
+
+} // namespace pipef
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "budget.h"
+#include "scheduler.h"
+#include "spill.h"
+#include "topology.h"
+
+namespace pipef {
+
+inline constexpr std::size_t cache_line_size = 64;
+
+// Rounds `n` up to the next power of two (at least 2)
+inline std::size_t round_up_pow2(std::size_t n) {
+    std::size_t p = 2;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+// What a link does with a new item once its ring is full
+enum class overflow {
+    block,       // stall the producer until the consumer makes room
+    drop_oldest, // evict the oldest queued item
+    drop_newest, // discard the new item
+    sample,      // keep 1 in N items once the ring is half full, discard the rest
+    spill,       // append to files on disk and replay them in order (see spill_codec)
+};
+
+// Capacity and overflow policy of a link; capacity is rounded up to a power of two
+struct link_options {
+    std::size_t capacity = 1024;
+    overflow policy = overflow::block;
+    std::size_t sample_every = 1;
+    bool fusible = true; // false once the user asked for explicit link behaviour
+    std::string spill_directory; // overflow::spill only; the system temporary directory if empty
+};
+
+// Link options for `a | bounded(capacity, policy) | b`
+inline link_options bounded(std::size_t capacity, overflow policy = overflow::block) {
+    return {capacity, policy, 1, false, {}};
+}
+
+// Link options for `a | sampled(capacity, n) | b`: keeps 1 in `n` items while the link is congested
+inline link_options sampled(std::size_t capacity, std::size_t n) {
+    return {capacity, overflow::sample, n, false, {}};
+}
+
+// Link options for `a | spilled(capacity) | b`: once `capacity` items are queued in memory,
+// further items go to disk until the consumer has caught up, so the producer is
+// neither stalled nor made to drop anything
+inline link_options spilled(std::size_t capacity, std::string directory = {}) {
+    return {capacity, overflow::spill, 1, false, std::move(directory)};
+}
+
+// Per-link overload counters
+struct link_stats {
+    std::uint64_t dropped = 0; // items discarded by drop_oldest, drop_newest or sample
+    std::uint64_t blocked = 0; // times the producer stalled on a full ring
+    std::uint64_t spilled = 0; // items written to disk by overflow::spill
+};
+
+// Hand-off queue behind a single `a | b` link.
+// Each link has exactly one producing and one consuming stage, and the scheduler
+// never runs a stage twice at once, so the link is a lock-free bounded SPSC ring.
+// Producer and consumer indices live on separate cache lines, and each side keeps
+// a cached copy of the other's index so the shared line is only read when the
+// ring looks full (producer) or empty (consumer).
+// With overflow::drop_oldest the producer also evicts from the head, so the head
+// is claimed with a CAS and per-slot sequence numbers tell the producer when the
+// consumer has finished moving an item out of a slot it is about to reuse.
+template <typename T>
+class channel {
+public:
+    channel(node* producer, node* consumer, const link_options& options = {})
+        : producer_(producer),
+          consumer_(consumer),
+          mask_(round_up_pow2(options.capacity) - 1),
+          policy_(options.policy),
+          sample_every_(options.sample_every == 0 ? 1 : options.sample_every),
+          fusible_(options.fusible),
+          budget_(producer ? producer->budget() : nullptr),
+          slots_(new slot[mask_ + 1]) {
+        for (std::size_t i = 0; i <= mask_; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        if (policy_ == overflow::spill) {
+            if constexpr (spillable<T>) {
+                spill_ = std::make_unique<spill_log>(options.spill_directory);
+            } else {
+                throw std::logic_error("pipef: overflow::spill needs a spill_codec for the link's item type");
+            }
+        }
+    }
+
+    ~channel() {
+        if constexpr (spillable<T>) {
+            // Decoded so that whatever spilled records hold on to is released
+            while (spill_ && !spill_->empty()) spill_codec<T>::decode(spill_->read());
+        }
+        for (std::size_t i = head_.load(); i != tail_.load(); ++i) {
+            slots_[i & mask_].get()->~T();
+        }
+    }
+
+    channel(const channel&) = delete;
+    channel& operator=(const channel&) = delete;
+
+    // Producer side: moves `item` into the ring; returns false if the ring is full
+    bool try_push(T& item) {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) return false;
+        }
+        slot& s = slots_[tail & mask_];
+        if (policy_ == overflow::drop_oldest) {
+            // The consumer may still be moving out the item previously stored here
+            while (s.seq.load(std::memory_order_acquire) != tail) std::this_thread::yield();
+        }
+        // Charged before the item becomes visible, so the consumer's credit can never come first
+        if (budget_) budget_->charge(payload_size<T>()(item));
+        ::new (s.storage) T(std::move(item));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Enqueues an item according to the link's overflow policy and wakes the consuming stage.
+    // Under overflow::block the producer must have checked writable() first.
+    void push(T item) {
+        switch (policy_) {
+        case overflow::block:
+            break;
+        case overflow::drop_oldest:
+            while (!try_push(item)) evict_oldest();
+            consumer_->notify();
+            return;
+        case overflow::drop_newest:
+            break;
+        case overflow::sample:
+            if (size() > mask_ / 2 && ++sample_count_ % sample_every_ != 0) {
+                count_drop();
+                return;
+            }
+            break;
+        case overflow::spill:
+            // Once anything is on disk, later items follow it there to stay in order
+            if (!spill_->empty() || !try_push(item)) spill_out(item);
+            consumer_->notify();
+            return;
+        }
+        if (try_push(item)) {
+            consumer_->notify();
+        } else {
+            count_drop();
+        }
+    }
+
+    // Consumer side: moves the oldest item out; returns false if the ring is empty
+    bool try_pop(T& item) {
+        if (policy_ == overflow::drop_oldest) return claim_head(&item);
+
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                if (!spill_ || spill_->empty()) return false;
+                // Spilled items are newer than anything in the ring, so look at the ring
+                // once more now that the spill's publication is visible
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                if (head == tail_cache_) return spill_in(item);
+            }
+        }
+        T* p = slots_[head & mask_].get();
+        std::size_t bytes = budget_ ? payload_size<T>()(*p) : 0;
+        item = std::move(*p);
+        p->~T();
+        head_.store(head + 1, std::memory_order_release);
+        if (budget_) budget_->credit(bytes);
+        return true;
+    }
+
+    bool pop(T& item) { return try_pop(item); }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire)
+            && (!spill_ || spill_->empty());
+    }
+
+    // Producer side: true if there is room for one more item.
+    // When the ring is full the producer is recorded as waiting, so the consumer wakes it after draining.
+    bool writable() const {
+        if (policy_ != overflow::block || !full()) return true;
+        if (!producer_waiting_.exchange(true, std::memory_order_seq_cst)) {
+            blocked_.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return !full();
+    }
+
+    // Consumer side: wakes a producer stalled on this ring; called once per consumer step
+    void release_producer() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (producer_waiting_.load(std::memory_order_relaxed)
+            && producer_waiting_.exchange(false, std::memory_order_acq_rel)) {
+            producer_->notify();
+        }
+    }
+
+    std::size_t capacity() const { return mask_ + 1; }
+    std::size_t size() const {
+        std::size_t n = tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+        return spill_ ? n + spill_->size() : n;
+    }
+
+    overflow policy() const { return policy_; }
+
+    link_stats stats() const {
+        return {dropped_.load(std::memory_order_relaxed), blocked_.load(std::memory_order_relaxed),
+                spilled_.load(std::memory_order_relaxed)};
+    }
+
+    bool fusible() const { return fusible_; }
+
+    node* producer() const { return producer_; }
+    node* consumer() const { return consumer_; }
+
+    // The memory budget items pushed into this link are charged to, if any
+    memory_budget* budget() const { return budget_; }
+
+    // Redirects stall wake-ups to the stage that actually pushes into this link (see transformer fusion)
+    void set_producer(node* producer) { producer_ = producer; }
+
+    // Moves the ring's slots to the consumer's NUMA node; small rings that share pages with other data stay put
+    void bind_to_numa_node(std::size_t numa_node) {
+        numa_topology::system().bind_memory(slots_.get(), sizeof(slot) * (mask_ + 1), numa_node);
+    }
+
+private:
+    struct slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+        std::atomic<std::size_t> seq;
+        T* get() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    // drop_oldest only: takes the head item for the consumer (`out` set) or discards it (producer)
+    bool claim_head(T* out) {
+        std::size_t head = head_.load(std::memory_order_acquire);
+        do {
+            if (head == tail_.load(std::memory_order_acquire)) return false;
+        } while (!head_.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel));
+
+        slot& s = slots_[head & mask_];
+        std::size_t bytes = budget_ ? payload_size<T>()(*s.get()) : 0;
+        if (out) *out = std::move(*s.get());
+        s.get()->~T();
+        s.seq.store(head + mask_ + 1, std::memory_order_release);
+        if (budget_) budget_->credit(bytes);
+        return true;
+    }
+
+    void spill_out(T& item) {
+        if constexpr (spillable<T>) {
+            spill_buffer_.clear();
+            spill_codec<T>::encode(std::move(item), spill_buffer_);
+            spill_->append(spill_buffer_);
+            spilled_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool spill_in(T& item) {
+        if constexpr (spillable<T>) {
+            item = spill_codec<T>::decode(spill_->read());
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    void evict_oldest() {
+        if (claim_head(nullptr)) count_drop();
+    }
+
+    void count_drop() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+
+    bool full() const {
+        return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) > mask_;
+    }
+
+    // Read-only while the engine runs
+    node* producer_;
+    node* const consumer_;
+    const std::size_t mask_;
+    const overflow policy_;
+    const std::size_t sample_every_;
+    const bool fusible_;
+    memory_budget* const budget_;
+    const std::unique_ptr<slot[]> slots_;
+    std::unique_ptr<spill_log> spill_;
+
+    // Consumer-owned line
+    alignas(cache_line_size) std::atomic<std::size_t> head_{0};
+    std::size_t tail_cache_ = 0;
+
+    // Producer-owned line
+    alignas(cache_line_size) std::atomic<std::size_t> tail_{0};
+    std::size_t head_cache_ = 0;
+    std::size_t sample_count_ = 0;
+    std::atomic<std::uint64_t> dropped_{0};
+    mutable std::atomic<std::uint64_t> blocked_{0};
+    std::atomic<std::uint64_t> spilled_{0};
+    std::string spill_buffer_;
+
+    alignas(cache_line_size) mutable std::atomic<bool> producer_waiting_{false};
+};
+
+} // namespace pipef
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "scheduler.h"
+
+namespace pipef {
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // Returns to the awaiting coroutine, or to whoever resumed the top-level task
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            auto next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object();
+    template <typename U>
+    void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+    T result() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object();
+    void return_void() {}
+
+    void result() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+} // namespace detail
+
+// Lazily started coroutine returned by coroutine stage callables.
+// A task can co_await another task; the awaiting coroutine resumes when it finishes.
+template <typename T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    task() = default;
+    explicit task(handle_type h) : handle_(h) {}
+    task(task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    ~task() {
+        if (handle_) handle_.destroy();
+    }
+
+    bool done() const { return !handle_ || handle_.done(); }
+    handle_type handle() const { return handle_; }
+
+    // Result of a finished task; rethrows what the coroutine threw
+    T result() { return handle_.promise().result(); }
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            handle_type handle;
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                handle.promise().continuation = caller;
+                return handle;
+            }
+            T await_resume() { return handle.promise().result(); }
+        };
+        return awaiter{handle_};
+    }
+
+private:
+    handle_type handle_;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object() {
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() {
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+template <typename T>
+struct is_task : std::false_type {};
+
+template <typename T>
+struct is_task<task<T>> : std::true_type {};
+
+template <typename T>
+inline constexpr bool is_task_v = is_task<std::remove_cvref_t<T>>::value;
+
+class coroutine_slot;
+
+// Parks suspended coroutines of one stage and resumes them inside that stage's step,
+// so coroutine bodies keep the one-invocation-at-a-time guarantee of ordinary stages
+class coroutine_host {
+public:
+    explicit coroutine_host(node& owner) : owner_(owner) {}
+
+    // Whether some parked coroutine's event has fired
+    bool woken() const { return woken_count_.load(std::memory_order_acquire) > 0; }
+
+private:
+    friend class coroutine_slot;
+    template <typename R>
+    friend class coroutine_pool;
+
+    void wake(coroutine_slot* slot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            woken_.push_back(slot);
+        }
+        woken_count_.fetch_add(1, std::memory_order_release);
+        owner_.notify();
+        owner_.release();
+    }
+
+    std::vector<coroutine_slot*> take_woken() {
+        std::vector<coroutine_slot*> slots;
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots.swap(woken_);
+        woken_count_.fetch_sub(slots.size(), std::memory_order_relaxed);
+        return slots;
+    }
+
+    node& owner_;
+    std::mutex mutex_;
+    std::vector<coroutine_slot*> woken_;
+    std::atomic<std::size_t> woken_count_{0};
+};
+
+// One in-flight coroutine invocation of a stage.
+// Leaf awaitables record the innermost suspended coroutine here and call wake()
+// from whichever thread observes their event.
+class coroutine_slot {
+public:
+    explicit coroutine_slot(coroutine_host& host) : host_(host) {}
+
+    // Slot of the coroutine currently being resumed on this thread, if any
+    static coroutine_slot*& current() {
+        thread_local coroutine_slot* slot = nullptr;
+        return slot;
+    }
+
+    // Records where to resume once the awaited event fires
+    void park(std::coroutine_handle<> h) { resume_point_ = h; }
+
+    // Marks the parked coroutine as waiting on an external event; undone by wake() or release()
+    void hold() { host_.owner_.hold(); }
+    void release() { host_.owner_.release(); }
+
+    // Called from any thread when the awaited event has fired
+    void wake() { host_.wake(this); }
+
+    // Resumes the parked coroutine on the calling thread
+    void resume() {
+        coroutine_slot* outer = std::exchange(current(), this);
+        std::exchange(resume_point_, {}).resume();
+        current() = outer;
+    }
+
+private:
+    coroutine_host& host_;
+    std::coroutine_handle<> resume_point_;
+};
+
+// In-flight coroutine invocations of a stage.
+// An ordered pool hands results back in start order (take_front); an unordered one
+// only reports failures of finished invocations (reap).
+template <typename R>
+class coroutine_pool : public coroutine_host {
+public:
+    static constexpr std::size_t default_limit = 1024;
+
+    coroutine_pool(node& owner, bool ordered, std::size_t limit = default_limit)
+        : coroutine_host(owner), ordered_(ordered), limit_(limit == 0 ? 1 : limit) {}
+
+    void set_limit(std::size_t limit) { limit_ = limit == 0 ? 1 : limit; }
+
+    bool full() const { return slots_.size() >= limit_; }
+    bool empty() const { return slots_.empty(); }
+    bool front_done() const { return !slots_.empty() && slots_.front().work.done(); }
+
+    // Runs a new invocation until its first suspension
+    void start(task<R> work) {
+        slots_.emplace_back(*this, std::move(work));
+        auto it = std::prev(slots_.end());
+        it->self = it;
+        it->park(it->work.handle());
+        run(*it);
+    }
+
+    // Resumes every invocation whose awaited event has fired
+    void resume_woken() {
+        for (coroutine_slot* s : this->take_woken()) run(static_cast<slot&>(*s));
+    }
+
+    // Result of the oldest invocation, which must be done
+    R take_front() {
+        task<R> work = std::move(slots_.front().work);
+        slots_.pop_front();
+        return work.result();
+    }
+
+    // Drops finished invocations, rethrowing the first error
+    void reap() {
+        std::vector<task<R>> finished;
+        for (auto it : done_) {
+            finished.push_back(std::move(it->work));
+            slots_.erase(it);
+        }
+        done_.clear();
+        for (auto& work : finished) work.result();
+    }
+
+private:
+    struct slot : coroutine_slot {
+        slot(coroutine_host& host, task<R> w) : coroutine_slot(host), work(std::move(w)) {}
+        task<R> work;
+        typename std::list<slot>::iterator self;
+    };
+
+    void run(slot& s) {
+        s.resume();
+        if (!ordered_ && s.work.done()) done_.push_back(s.self);
+    }
+
+    std::list<slot> slots_;
+    std::vector<typename std::list<slot>::iterator> done_;
+    bool ordered_;
+    std::size_t limit_;
+};
+
+// Base for leaf awaitables that suspend a stage coroutine until some external event
+struct event_awaiter {
+    bool await_ready() const noexcept { return false; }
+    void await_resume() const noexcept {}
+
+protected:
+    // Parks the coroutine in the slot being resumed on this thread and returns that slot
+    static coroutine_slot& park(std::coroutine_handle<> h) {
+        coroutine_slot* slot = coroutine_slot::current();
+        if (!slot) throw std::logic_error("pipef: event awaited outside of a coroutine stage");
+        slot->park(h);
+        slot->hold();
+        return *slot;
+    }
+};
+
+} // namespace pipef
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "budget.h"
+#include "reactor.h"
+#include "scheduler.h"
+
+namespace pipef {
+
+// Passed as loop_count or duration_ms to run without that limit
+inline constexpr int INFINITE = -1;
+
+// Owns the pipeline stages and the worker pool that runs them
+class engine {
+public:
+    // Creates an engine running its stages on `worker_count` threads (one per core by default).
+    // A non-zero `memory_budget` caps the bytes of items queued in links (see payload_size):
+    // sources pause while it is used up, whatever the item counts of the individual links.
+    static std::shared_ptr<engine> create(std::size_t worker_count = default_worker_count(),
+                                          std::size_t memory_budget = 0) {
+        return std::shared_ptr<engine>(new engine(worker_count, memory_budget));
+    }
+
+    // Creates a stage owned by this engine
+    template <typename Stage, typename... Args>
+    std::shared_ptr<Stage> create(Args&&... args) {
+        auto stage = std::make_shared<Stage>(std::forward<Args>(args)...);
+        stage->sched_ = &scheduler_;
+        stage->budget_ = budget_.get();
+        stages_.push_back(stage);
+        return stage;
+    }
+
+    // Runs each source `loop_count` times, stopping early after `duration_ms`;
+    // returns once the pipeline has drained or the time is up
+    void run(int loop_count = INFINITE, int duration_ms = INFINITE) {
+        auto nodes = prepare(loop_count);
+        scheduler_.begin(nodes, deadline_after(duration_ms));
+        scheduler_.work();
+        // Descriptor waits still parked are woken as cancelled, so the reactor keeps no
+        // reference to a stage once the run is over
+        if (reactor* r = reactor::existing()) r->cancel_all(scheduler_);
+        finish(nodes);
+    }
+
+    // Like run(), but every stage runs on the thread of an external event loop
+    // (e.g. uv_driver from uv.h) that also delivers descriptor readiness
+    template <typename Driver>
+    void run_on(Driver& driver, int loop_count = INFINITE, int duration_ms = INFINITE) {
+        auto nodes = prepare(loop_count);
+        scheduler_.begin(nodes, deadline_after(duration_ms));
+        try {
+            driver.drive(scheduler_);
+        } catch (...) {
+            finish(nodes);
+            throw;
+        }
+        finish(nodes);
+    }
+
+    std::size_t worker_count() const { return scheduler_.worker_count(); }
+
+    // Bytes currently charged to the memory budget; 0 without one
+    std::size_t in_flight_bytes() const { return budget_ ? budget_->in_flight() : 0; }
+
+    // How idle workers wait for work in later runs; stages can override it with node::set_wait_strategy
+    void set_wait_strategy(wait_strategy w) { scheduler_.set_wait_strategy(w); }
+
+    // Opt-in for engines with more than one socket's worth of workers: pins workers to NUMA
+    // nodes, runs stages hinted with node::set_numa_node on workers of that node and moves
+    // their input rings there. slab_pool keeps a free list per node, so workers reuse pooled
+    // slots released on their own node; frame_pool buffers are not placed. Has no effect on
+    // single-node machines.
+    void set_numa_placement(bool on) { scheduler_.set_numa_placement(on); }
+
+    static std::size_t default_worker_count() {
+        std::size_t n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : n;
+    }
+
+private:
+    engine(std::size_t worker_count, std::size_t memory_budget)
+        : scheduler_(worker_count),
+          budget_(memory_budget == 0 ? nullptr : std::make_unique<pipef::memory_budget>(memory_budget)) {}
+
+    static std::chrono::steady_clock::time_point deadline_after(int duration_ms) {
+        return duration_ms == INFINITE
+            ? std::chrono::steady_clock::time_point::max()
+            : std::chrono::steady_clock::now() + std::chrono::milliseconds(duration_ms);
+    }
+
+    // Starts every stage and fuses linear transformer chains; returns all schedulable nodes
+    std::vector<node*> prepare(int loop_count) {
+        std::vector<node*> nodes;
+        nodes.reserve(stages_.size());
+        for (auto& stage : stages_) {
+            nodes.push_back(stage.get());
+            for (node* helper : stage->helpers()) nodes.push_back(helper);
+        }
+        for (node* n : nodes) {
+            n->sched_ = &scheduler_;
+            n->absorbed_ = false;
+            n->start(loop_count);
+        }
+        for (node* n : nodes) n->fuse();
+        for (node* n : nodes) {
+            if (!n->absorbed_) n->adopt_outputs(n);
+        }
+        if (scheduler_.numa_placement()) {
+            for (node* n : nodes) {
+                if (n->numa_node_ >= 0) n->place_inputs(static_cast<std::size_t>(n->numa_node_));
+            }
+        }
+        return nodes;
+    }
+
+    void finish(const std::vector<node*>& nodes) {
+        scheduler_.finish(nodes);
+        if (budget_) budget_->forget_waiters();
+    }
+
+    scheduler scheduler_;
+    std::unique_ptr<memory_budget> budget_; // outlives the stages and their links
+    std::vector<std::shared_ptr<node>> stages_;
+};
+
+} // namespace pipef
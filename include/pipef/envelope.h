@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "budget.h"
+#include "pool.h"
+
+namespace pipef {
+
+// Reference-counted payload handle for passing large items between stages, in place of std::shared_ptr.
+// The count lives in the same pooled block as the value. While an envelope has a single
+// owner, which is every hop over a single-consumer link since items are moved along,
+// it is never touched: moves and the final release cost no atomic operation. The first copy,
+// made for instance when a stage fans out to several links, switches the block to an
+// atomic count for the rest of its life.
+template <typename T>
+class envelope {
+public:
+    envelope() noexcept = default;
+    envelope(std::nullptr_t) noexcept {}
+
+    envelope(const envelope& other) noexcept : block_(other.block_) { retain(); }
+    envelope(envelope&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {}
+
+    envelope& operator=(const envelope& other) noexcept {
+        envelope(other).swap(*this);
+        return *this;
+    }
+    envelope& operator=(envelope&& other) noexcept {
+        envelope(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~envelope() { reset(); }
+
+    void reset() noexcept {
+        block* b = std::exchange(block_, nullptr);
+        if (!b) return;
+        if (b->shared && b->count.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        b->~block();
+        slab_pool<block>::instance().deallocate(b);
+    }
+
+    void swap(envelope& other) noexcept { std::swap(block_, other.block_); }
+
+    T* get() const noexcept { return block_ ? &block_->value : nullptr; }
+    T& operator*() const noexcept { return block_->value; }
+    T* operator->() const noexcept { return &block_->value; }
+    explicit operator bool() const noexcept { return block_ != nullptr; }
+
+    // Whether this is the only reference, i.e. the value may be modified freely
+    bool unique() const noexcept {
+        return block_ && (!block_->shared || block_->count.load(std::memory_order_acquire) == 1);
+    }
+
+    friend bool operator==(const envelope& a, std::nullptr_t) noexcept { return !a.block_; }
+
+private:
+    template <typename U, typename... Args>
+    friend envelope<U> make_envelope(Args&&... args);
+
+    struct block {
+        template <typename... Args>
+        explicit block(Args&&... args) : value(std::forward<Args>(args)...) {}
+
+        T value;
+        bool shared = false; // set by the first copy, before the envelope can reach another thread
+        std::atomic<std::uint32_t> count{1};
+    };
+
+    void retain() noexcept {
+        if (!block_) return;
+        if (!block_->shared) {
+            // Still single-owner, so no other thread can be looking at the block
+            block_->shared = true;
+            block_->count.store(2, std::memory_order_relaxed);
+        } else {
+            block_->count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    block* block_ = nullptr;
+};
+
+template <typename T, typename... Args>
+envelope<T> make_envelope(Args&&... args) {
+    using block = typename envelope<T>::block;
+    void* p = slab_pool<block>::instance().allocate();
+    envelope<T> e;
+    try {
+        e.block_ = ::new (p) block(std::forward<Args>(args)...);
+    } catch (...) {
+        slab_pool<block>::instance().deallocate(p);
+        throw;
+    }
+    return e;
+}
+
+template <typename T>
+struct payload_size<envelope<T>> {
+    std::size_t operator()(const envelope<T>& e) const { return sizeof(e) + (e ? payload_size<T>()(*e) : 0); }
+};
+
+template <typename T>
+struct is_envelope : std::false_type {};
+
+template <typename T>
+struct is_envelope<envelope<T>> : std::true_type {};
+
+// Items that are cheap to copy for every branch of a fan-out instead of going through a shared slot
+template <typename T>
+inline constexpr bool is_envelope_v = is_envelope<T>::value;
+
+} // namespace pipef
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <vector>
+
+#include "budget.h"
+#include "pool.h"
+
+namespace pipef {
+
+// A large, fixed-size, 64-byte aligned buffer handed out by a frame_pool.
+// Its contents are uninitialized when first allocated and stale when recycled.
+class frame {
+public:
+    static constexpr std::size_t alignment = 64;
+
+    std::uint8_t* data() { return data_; }
+    const std::uint8_t* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    std::span<std::uint8_t> bytes() { return {data_, size_}; }
+    std::span<const std::uint8_t> bytes() const { return {data_, size_}; }
+
+    // Whether the buffer is backed by huge pages
+    bool huge_pages() const { return mapped_; }
+
+    ~frame() {
+        if (mapped_) {
+            ::munmap(data_, mapped_size_);
+        } else {
+            ::operator delete(data_, std::align_val_t(alignment));
+        }
+    }
+
+    frame(const frame&) = delete;
+    frame& operator=(const frame&) = delete;
+
+private:
+    friend class frame_pool;
+
+    frame(std::size_t size, bool huge_pages) : size_(size) {
+        if (huge_pages && map_huge(size)) return;
+        data_ = static_cast<std::uint8_t*>(::operator new(size, std::align_val_t(alignment)));
+    }
+
+    // Explicit huge pages if the system reserved any, otherwise transparent huge pages
+    bool map_huge(std::size_t size) {
+        constexpr std::size_t huge_page = 2 * 1024 * 1024;
+        std::size_t length = (size + huge_page - 1) / huge_page * huge_page;
+        void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (p == MAP_FAILED) {
+            p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) return false;
+#ifdef MADV_HUGEPAGE
+            ::madvise(p, length, MADV_HUGEPAGE);
+#endif
+        }
+        data_ = static_cast<std::uint8_t*>(p);
+        mapped_size_ = length;
+        mapped_ = true;
+        return true;
+    }
+
+    std::uint8_t* data_ = nullptr;
+    std::size_t size_;
+    std::size_t mapped_size_ = 0;
+    bool mapped_ = false;
+};
+
+using frame_ptr = std::shared_ptr<frame>;
+
+template <>
+struct payload_size<frame> {
+    std::size_t operator()(const frame& f) const { return sizeof(f) + f.size(); }
+};
+
+// Recycles frames of one size, e.g. raw video frames read by a source.
+// A frame goes back to the pool when its last reference is dropped (typically by
+// the sink at the end of the pipeline), so steady-state streaming allocates, zero-fills
+// and page-faults no new memory. Outstanding frames keep the pool alive.
+class frame_pool : public std::enable_shared_from_this<frame_pool> {
+public:
+    // `max_idle` caps how many returned frames are kept for reuse; the rest are freed
+    static std::shared_ptr<frame_pool> create(std::size_t frame_size, bool huge_pages = false,
+                                              std::size_t max_idle = 64) {
+        return std::shared_ptr<frame_pool>(new frame_pool(frame_size, huge_pages, max_idle));
+    }
+
+    frame_ptr acquire() {
+        std::unique_ptr<frame> f;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                f = std::move(idle_.back());
+                idle_.pop_back();
+            }
+        }
+        if (!f) f.reset(new frame(frame_size_, huge_pages_));
+        return frame_ptr(f.release(), recycler{shared_from_this()}, pool_allocator<frame>());
+    }
+
+    std::size_t frame_size() const { return frame_size_; }
+
+    // Frames currently waiting for reuse
+    std::size_t idle() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return idle_.size();
+    }
+
+private:
+    struct recycler {
+        std::shared_ptr<frame_pool> pool;
+        void operator()(frame* f) const { pool->recycle(std::unique_ptr<frame>(f)); }
+    };
+
+    frame_pool(std::size_t frame_size, bool huge_pages, std::size_t max_idle)
+        : frame_size_(frame_size), huge_pages_(huge_pages), max_idle_(max_idle) {}
+
+    void recycle(std::unique_ptr<frame> f) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (idle_.size() < max_idle_) idle_.push_back(std::move(f));
+    }
+
+    const std::size_t frame_size_;
+    const bool huge_pages_;
+    const std::size_t max_idle_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<frame>> idle_;
+};
+
+} // namespace pipef
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace pipef {
+
+template <typename Sig, std::size_t Capacity = 64>
+class inline_function;
+
+// Move-only callable wrapper used for stage callables in place of std::function.
+// Callables up to `Capacity` bytes (a lambda capturing a few strings or shared_ptrs)
+// live inside the wrapper itself, so a stage holds its callable without a heap
+// allocation, and a call is a single indirect jump to a thunk the compiler can
+// inline the callable into. Larger callables fall back to the heap.
+template <typename R, typename... Args, std::size_t Capacity>
+class inline_function<R(Args...), Capacity> {
+public:
+    inline_function() noexcept = default;
+    inline_function(std::nullptr_t) noexcept {}
+
+    template <typename F, typename D = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<D, inline_function>
+                                          && std::is_invocable_r_v<R, D&, Args...>>>
+    inline_function(F&& fn) {
+        if constexpr (stored_inline<D>) {
+            ::new (static_cast<void*>(storage_)) D(std::forward<F>(fn));
+            invoke_ = &invoke_inline<D>;
+            manage_ = &manage_inline<D>;
+        } else {
+            *reinterpret_cast<D**>(storage_) = new D(std::forward<F>(fn));
+            invoke_ = &invoke_heap<D>;
+            manage_ = &manage_heap<D>;
+        }
+    }
+
+    inline_function(inline_function&& other) noexcept { take(other); }
+
+    inline_function& operator=(inline_function&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    inline_function(const inline_function&) = delete;
+    inline_function& operator=(const inline_function&) = delete;
+
+    ~inline_function() { reset(); }
+
+    explicit operator bool() const noexcept { return invoke_ != nullptr; }
+
+    // Like std::function, calls the target as a non-const lvalue so mutable lambdas work
+    R operator()(Args... args) const {
+        return invoke_(const_cast<unsigned char*>(storage_), std::forward<Args>(args)...);
+    }
+
+private:
+    enum class op { move, destroy };
+
+    template <typename D>
+    static constexpr bool stored_inline = sizeof(D) <= Capacity
+        && alignof(D) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<D>;
+
+    template <typename D>
+    static R call(D& fn, Args&&... args) {
+        if constexpr (std::is_void_v<R>) {
+            std::invoke(fn, std::forward<Args>(args)...);
+        } else {
+            return std::invoke(fn, std::forward<Args>(args)...);
+        }
+    }
+
+    template <typename D>
+    static R invoke_inline(void* p, Args&&... args) {
+        return call(*std::launder(static_cast<D*>(p)), std::forward<Args>(args)...);
+    }
+
+    template <typename D>
+    static R invoke_heap(void* p, Args&&... args) {
+        return call(**static_cast<D**>(p), std::forward<Args>(args)...);
+    }
+
+    template <typename D>
+    static void manage_inline(op what, void* self, void* other) noexcept {
+        D* fn = std::launder(static_cast<D*>(self));
+        if (what == op::move) ::new (other) D(std::move(*fn));
+        fn->~D();
+    }
+
+    template <typename D>
+    static void manage_heap(op what, void* self, void* other) noexcept {
+        if (what == op::move) {
+            *static_cast<D**>(other) = *static_cast<D**>(self);
+        } else {
+            delete *static_cast<D**>(self);
+        }
+    }
+
+    // Moves the target of `other` into this empty wrapper, leaving `other` empty
+    void take(inline_function& other) noexcept {
+        if (!other.invoke_) return;
+        other.manage_(op::move, other.storage_, storage_);
+        invoke_ = std::exchange(other.invoke_, nullptr);
+        manage_ = std::exchange(other.manage_, nullptr);
+    }
+
+    void reset() noexcept {
+        if (!invoke_) return;
+        manage_(op::destroy, storage_, nullptr);
+        invoke_ = nullptr;
+        manage_ = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity < sizeof(void*) ? sizeof(void*) : Capacity];
+    R (*invoke_)(void*, Args&&...) = nullptr;
+    void (*manage_)(op, void*, void*) noexcept = nullptr;
+};
+
+} // namespace pipef
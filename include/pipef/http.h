@@ -0,0 +1,430 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include "bytes.h"
+#include "stage.h"
+#include "tcp.h"
+
+namespace pipef {
+
+namespace detail {
+
+inline bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool icontains(std::string_view s, std::string_view part) {
+    for (std::size_t i = 0; i + part.size() <= s.size(); ++i) {
+        if (iequals(s.substr(i, part.size()), part)) return true;
+    }
+    return false;
+}
+
+} // namespace detail
+
+// Value of a header of an HTTP request, without surrounding blanks; empty if it is absent.
+// The name is matched case-insensitively.
+inline std::string_view http_header(std::string_view request, std::string_view name) {
+    std::size_t end = request.find("\r\n");
+    while (end != std::string_view::npos) {
+        std::size_t start = end + 2;
+        end = request.find("\r\n", start);
+        std::string_view line = request.substr(start, end == std::string_view::npos ? end : end - start);
+        if (line.empty()) break; // end of the header block
+        auto colon = line.find(':');
+        if (colon == name.size() && detail::iequals(line.substr(0, colon), name)) {
+            std::string_view value = line.substr(colon + 1);
+            auto first = value.find_first_not_of(" \t");
+            if (first == std::string_view::npos) return {};
+            return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+        }
+    }
+    return {};
+}
+
+// Whether the connection may stay open after answering `request`: HTTP/1.1 unless it
+// asks to close, HTTP/1.0 only if it asks to be kept alive
+inline bool http_keep_alive(std::string_view request) {
+    std::string_view line = request.substr(0, request.find("\r\n"));
+    std::string_view connection = http_header(request, "Connection");
+    if (line.ends_with("HTTP/1.1")) return !detail::icontains(connection, "close");
+    return detail::icontains(connection, "keep-alive");
+}
+
+// Largest header block and body of a request that http_request_size waits for
+inline constexpr std::size_t http_max_header_size = 64 * 1024;
+inline constexpr std::size_t http_max_body_size = 16 * 1024 * 1024;
+
+// Content-Length of an HTTP request, 0 without one; std::nullopt if it is not a number
+// or above http_max_body_size
+inline std::optional<std::size_t> http_content_length(std::string_view request) {
+    std::size_t length = 0;
+    for (char c : http_header(request, "Content-Length")) {
+        if (c < '0' || c > '9') return std::nullopt;
+        length = length * 10 + static_cast<std::size_t>(c - '0');
+        if (length > http_max_body_size) return std::nullopt; // before it could overflow
+    }
+    return length;
+}
+
+// Whether a request cannot be answered but with a 400 and closing the connection: its header
+// block is incomplete or above http_max_header_size, or its Content-Length is invalid
+inline bool http_malformed(std::string_view request) {
+    std::size_t end = request.find("\r\n\r\n");
+    return end == std::string_view::npos || end + 4 > http_max_header_size
+        || !http_content_length(request.substr(0, end + 4));
+}
+
+// tcp_framer for HTTP/1.x requests: the header block and a Content-Length body, so pipelined
+// requests come out one per item. A malformed request (see http_malformed) takes whatever is
+// buffered, so neither its body nor the bytes after it are parsed as further requests.
+// Chunked request bodies are not supported.
+inline std::size_t http_request_size(std::string_view buffered) {
+    std::size_t end = buffered.find("\r\n\r\n");
+    if (end == std::string_view::npos) return buffered.size() > http_max_header_size ? buffered.size() : 0;
+
+    std::size_t size = end + 4;
+    std::optional<std::size_t> body = http_content_length(buffered.substr(0, size));
+    if (size > http_max_header_size || !body) return buffered.size();
+    size += *body;
+    return buffered.size() >= size ? size : 0;
+}
+
+// Answers every request with the same file: the response headers are built once, and the body is
+// sent by the output sink with sendfile() straight from the page cache, so neither the file nor a
+// per-request copy of it ever lives on the heap. The request's buffer is reused for the headers.
+// The connection is kept alive if the request allows it (see http_keep_alive), until the
+// source's idle_timeout() closes it; a malformed request gets a 400 and the connection is closed.
+// e.g. `tcp_input_source | file_response("index.html") | tcp_output_sink`
+class file_response : public transformer<tcp_message> {
+public:
+    explicit file_response(const std::string& path, std::string_view content_type = "text/html")
+        : transformer<tcp_message>([this](tcp_message&& msg) { return respond(std::move(msg)); }),
+          file_(std::make_shared<const file_body>(path)) {
+        std::string header = "HTTP/1.1 200 OK\r\nContent-Type: ";
+        header += content_type;
+        header += "\r\nContent-Length: ";
+        header += std::to_string(file_->size());
+        header_keep_alive_ = header + "\r\nConnection: keep-alive\r\n\r\n";
+        header_close_ = header + "\r\nConnection: close\r\n\r\n";
+        bad_request_ = "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\nContent-Length: 16\r\n"
+                       "Connection: close\r\n\r\n400 Bad Request\n";
+    }
+
+    const file_body& file() const { return *file_; }
+
+private:
+    tcp_message respond(tcp_message&& msg) const {
+        if (http_malformed(msg.data)) {
+            msg.keep_alive = false;
+            msg.data.assign(bad_request_);
+            msg.file = nullptr;
+            return std::move(msg);
+        }
+        msg.keep_alive = http_keep_alive(msg.data);
+        msg.data.assign(msg.keep_alive ? header_keep_alive_ : header_close_);
+        msg.file = file_;
+        return std::move(msg);
+    }
+
+    std::shared_ptr<const file_body> file_;
+    std::string header_keep_alive_;
+    std::string header_close_;
+    std::string bad_request_;
+};
+
+// Serves the files under a directory from fully serialized responses (headers and body in one
+// shared buffer), so a request for a cached path costs a lookup and the reply is sent from the
+// cache without a copy. Entries are keyed by request path and remember a hash of their content,
+// sent as the ETag; files above max_cached_size keep only their headers and go out with sendfile().
+// An inotify watch on the directories of cached files marks entries stale when a file is written,
+// replaced or removed. It is drained at most every `refresh_interval`, without a system call on
+// the request path in between. A stale entry is re-read on its next request and only
+// re-serialized if its content hash changed.
+// Answers GET and HEAD, keeping the connection alive if the request allows it: the Connection
+// header goes between the cached headers and body as a buffer of its own. Frame the source with
+// http_request_size so that pipelined requests are each answered; malformed ones get a 400
+// and close the connection. The stage keeps the cache unsynchronized, so it must not run parallel().
+class response_cache : public transformer<tcp_message> {
+public:
+    static constexpr std::size_t max_cached_size = 1024 * 1024;
+
+    explicit response_cache(std::string root, std::string index = "index.html",
+                            std::chrono::milliseconds refresh_interval = std::chrono::milliseconds(100))
+        : transformer<tcp_message>([this](tcp_message&& msg) { return respond(std::move(msg)); }),
+          root_(std::move(root)), index_(std::move(index)), refresh_interval_(refresh_interval),
+          inotify_fd_(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {
+        if (inotify_fd_ < 0) throw std::system_error(errno, std::generic_category(), "inotify_init1");
+        bool absolute = root_.starts_with('/');
+        while (!root_.empty() && root_.back() == '/') root_.pop_back();
+        if (root_.empty() && !absolute) root_ = ".";
+        serialize_status(bad_request_, "400 Bad Request");
+        serialize_status(not_found_, "404 Not Found");
+        serialize_status(not_allowed_, "405 Method Not Allowed");
+    }
+
+    ~response_cache() override { ::close(inotify_fd_); }
+
+    // Entries cached, fresh or stale
+    std::size_t size() const { return entries_.size(); }
+
+private:
+    struct entry {
+        std::string file_path;
+        bytes response;          // headers but the last, then the body unless it is sent from `file`
+        std::size_t header_size = 0;
+        std::shared_ptr<const file_body> file;
+        std::uint64_t hash = 0;
+        bool stale = false;
+    };
+
+    struct string_hash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+
+    tcp_message respond(tcp_message&& msg) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_refresh_) {
+            refresh();
+            next_refresh_ = now + refresh_interval_;
+        }
+
+        std::string_view request(msg.data);
+        auto method_end = request.find(' ');
+        auto target_end = request.find_first_of(" \r\n", method_end + 1);
+        const entry* reply = &bad_request_;
+        bool head = false;
+        if (method_end != std::string_view::npos && target_end != std::string_view::npos
+            && !http_malformed(request)) {
+            std::string_view method = request.substr(0, method_end);
+            std::string_view target = request.substr(method_end + 1, target_end - method_end - 1);
+            target = target.substr(0, target.find_first_of("?#"));
+            head = method == "HEAD";
+            if (method != "GET" && !head) {
+                reply = &not_allowed_;
+            } else if (entry* e = lookup(target)) {
+                reply = e;
+            } else if (valid_target(target)) {
+                reply = &not_found_;
+            }
+        }
+        msg.keep_alive = reply != &bad_request_ && http_keep_alive(request);
+
+        msg.data.clear();
+        msg.body.clear();
+        msg.body.reserve(3);
+        msg.body.push_back(reply->response.slice(0, reply->header_size));
+        msg.body.push_back(msg.keep_alive ? keep_alive_ : close_);
+        if (!head && reply->response.size() > reply->header_size) {
+            msg.body.push_back(reply->response.slice(reply->header_size));
+        }
+        msg.file = head ? nullptr : reply->file;
+        return std::move(msg);
+    }
+
+    static bool valid_target(std::string_view target) {
+        if (target.empty() || target.front() != '/') return false;
+        for (std::size_t start = 1; start <= target.size();) {
+            std::size_t end = std::min(target.find('/', start), target.size());
+            if (target.substr(start, end - start) == "..") return false;
+            start = end + 1;
+        }
+        return target.find('\0') == std::string_view::npos;
+    }
+
+    // The fresh entry for `target`, loading it on a miss or when stale; null if there is no such file
+    entry* lookup(std::string_view target) {
+        auto it = entries_.find(target);
+        if (it != entries_.end() && !it->second.stale) return &it->second;
+        if (!valid_target(target)) return nullptr;
+
+        if (it == entries_.end()) {
+            entry e;
+            e.file_path = root_;
+            e.file_path += target;
+            if (e.file_path.back() == '/') e.file_path += index_;
+            it = entries_.emplace(std::string(target), std::move(e)).first;
+        }
+        if (!load(it->second)) {
+            entries_.erase(it);
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    bool load(entry& e) {
+        int fd = ::open(e.file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st{};
+        std::string body;
+        bool ok = ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        auto size = static_cast<std::size_t>(st.st_size);
+        if (ok && size <= max_cached_size) {
+            body.resize(size);
+            std::size_t done = 0;
+            while (done < size) {
+                ssize_t n = ::pread(fd, body.data() + done, size - done, static_cast<off_t>(done));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                done += static_cast<std::size_t>(n);
+            }
+            body.resize(done);
+        }
+        ::close(fd);
+        if (!ok) return false;
+        watch_directory(e.file_path);
+
+        std::shared_ptr<const file_body> file;
+        std::uint64_t hash;
+        if (size <= max_cached_size) {
+            hash = fnv1a(body);
+        } else {
+            // Too large to hash on a request; identified by inode, size and modification time
+            file = std::make_shared<const file_body>(e.file_path);
+            std::int64_t identity[] = {static_cast<std::int64_t>(st.st_ino), st.st_size, st.st_mtim.tv_sec,
+                                       st.st_mtim.tv_nsec};
+            hash = fnv1a(std::string_view(reinterpret_cast<const char*>(identity), sizeof(identity)));
+        }
+        e.stale = false;
+        // Same content: the serialized response is still right
+        if (!file && !e.file && !e.response.empty() && hash == e.hash) return true;
+
+        std::string response = serialize_headers("200 OK", content_type(e.file_path),
+                                                 file ? file->size() : body.size(), hash);
+        e.header_size = response.size();
+        response += body;
+        e.response = bytes(std::move(response));
+        e.file = std::move(file);
+        e.hash = hash;
+        return true;
+    }
+
+    void watch_directory(const std::string& file_path) {
+        std::string directory = file_path.substr(0, file_path.rfind('/'));
+        if (directory.empty()) directory = "/";
+        int wd = ::inotify_add_watch(inotify_fd_, directory.c_str(),
+                                     IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO
+                                         | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF);
+        if (wd >= 0) directories_[wd] = std::move(directory);
+    }
+
+    // Marks the entries of changed files stale
+    void refresh() {
+        alignas(inotify_event) char buffer[4096];
+        for (;;) {
+            ssize_t n = ::read(inotify_fd_, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            for (char* p = buffer; p < buffer + n;) {
+                auto* ev = reinterpret_cast<inotify_event*>(p);
+                p += sizeof(inotify_event) + ev->len;
+
+                auto dir = directories_.find(ev->wd);
+                if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    if (dir != directories_.end() && (ev->mask & IN_IGNORED)) directories_.erase(dir);
+                    mark_all_stale();
+                } else if (dir == directories_.end() || (ev->mask & IN_Q_OVERFLOW) || ev->len == 0) {
+                    mark_all_stale();
+                } else {
+                    std::string path = dir->second == "/" ? "" : dir->second;
+                    path += '/';
+                    path += ev->name;
+                    for (auto& [target, e] : entries_) {
+                        if (e.file_path == path) e.stale = true;
+                    }
+                }
+            }
+        }
+    }
+
+    void mark_all_stale() {
+        for (auto& [target, e] : entries_) e.stale = true;
+    }
+
+    static std::string serialize_headers(std::string_view status, std::string_view type, std::size_t length,
+                                         std::uint64_t hash) {
+        static constexpr char digits[] = "0123456789abcdef";
+        char etag[16];
+        for (int i = 0; i < 16; ++i) etag[i] = digits[(hash >> (60 - 4 * i)) & 0xf];
+
+        std::string s = "HTTP/1.1 ";
+        s += status;
+        s += "\r\nContent-Type: ";
+        s += type;
+        s += "\r\nContent-Length: ";
+        s += std::to_string(length);
+        s += "\r\nETag: \"";
+        s.append(etag, sizeof(etag));
+        s += "\"\r\n";
+        return s;
+    }
+
+    static void serialize_status(entry& e, std::string_view status) {
+        std::string body(status);
+        body += '\n';
+        std::string response = serialize_headers(status, "text/plain", body.size(), fnv1a(body));
+        e.header_size = response.size();
+        e.response = bytes(response + body);
+    }
+
+    static std::string_view content_type(std::string_view path) {
+        static constexpr std::pair<std::string_view, std::string_view> types[] = {
+            {".html", "text/html"},         {".htm", "text/html"},       {".css", "text/css"},
+            {".js", "text/javascript"},     {".json", "application/json"}, {".txt", "text/plain"},
+            {".svg", "image/svg+xml"},      {".png", "image/png"},       {".jpg", "image/jpeg"},
+            {".jpeg", "image/jpeg"},        {".gif", "image/gif"},       {".ico", "image/x-icon"},
+            {".wasm", "application/wasm"},
+        };
+        for (auto& [extension, type] : types) {
+            if (path.ends_with(extension)) return type;
+        }
+        return "application/octet-stream";
+    }
+
+    static std::uint64_t fnv1a(std::string_view s, std::uint64_t h = 0xcbf29ce484222325ull) {
+        for (unsigned char c : s) h = (h ^ c) * 0x100000001b3ull;
+        return h;
+    }
+
+    std::string root_;
+    const std::string index_;
+    const std::chrono::steady_clock::duration refresh_interval_;
+    const int inotify_fd_;
+    std::chrono::steady_clock::time_point next_refresh_{};
+
+    std::unordered_map<std::string, entry, string_hash, std::equal_to<>> entries_;
+    std::unordered_map<int, std::string> directories_; // inotify watch → directory
+    entry bad_request_;
+    entry not_found_;
+    entry not_allowed_;
+    const bytes keep_alive_{std::string("Connection: keep-alive\r\n\r\n")};
+    const bytes close_{std::string("Connection: close\r\n\r\n")};
+};
+
+} // namespace pipef
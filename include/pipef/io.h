@@ -0,0 +1,70 @@
+#pragma once
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include "coroutine.h"
+#include "reactor.h"
+#include "stage.h"
+
+namespace pipef {
+
+// Emits the lines typed on a terminal (or piped into a descriptor), without the trailing newline.
+// The source only reads once poll() reports input, and otherwise waits through the reactor or
+// an external event loop, so no worker sits in read() while nothing is typed. The descriptor's
+// flags are left alone: O_NONBLOCK would be shared with every process using the terminal, and
+// would outlive the source if the program exits without running destructors.
+class key_input_src : public source<std::string> {
+public:
+    explicit key_input_src(int fd = STDIN_FILENO)
+        : source<std::string>([this] { return next_line(); }), fd_(fd) {}
+
+private:
+    // One line per invocation; end of input flushes a final unterminated line, then ends the stream
+    task<std::optional<std::string>> next_line() {
+        for (;;) {
+            std::size_t eol = pending_.find('\n');
+            if (eol != std::string::npos) {
+                std::string line = pending_.substr(0, eol);
+                pending_.erase(0, eol + 1);
+                co_return line;
+            }
+            if (eof_) {
+                if (pending_.empty()) co_return std::nullopt;
+                co_return std::exchange(pending_, {});
+            }
+
+            if (!readable()) {
+                co_await wait_readable(fd_);
+                continue;
+            }
+            char buffer[4096];
+            ssize_t n = ::read(fd_, buffer, sizeof(buffer));
+            if (n > 0) {
+                pending_.append(buffer, static_cast<std::size_t>(n));
+            } else if (n == 0) {
+                eof_ = true;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                throw std::system_error(errno, std::generic_category(), "read");
+            }
+        }
+    }
+
+    // Whether read() returns at once: input, end of input or an error is pending
+    bool readable() const {
+        pollfd p{fd_, POLLIN, 0};
+        return ::poll(&p, 1, 0) > 0;
+    }
+
+    int fd_;
+    std::string pending_;
+    bool eof_ = false;
+};
+
+} // namespace pipef
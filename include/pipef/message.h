@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <variant>
+
+#include "budget.h"
+#include "spill.h"
+
+namespace pipef {
+
+// Slot an item fanned out to several links is published into, created with one reader per branch.
+// It is charged to the memory budget once, until the last branch lets go of it.
+template <typename T>
+struct shared_item {
+    shared_item(std::size_t readers, T value, memory_budget* budget)
+        : value(std::move(value)), readers(readers), budget(budget),
+          charged(budget ? payload_size<T>()(this->value) : 0) {
+        if (budget) budget->charge(charged);
+    }
+    ~shared_item() {
+        if (budget) budget->credit(charged);
+    }
+
+    shared_item(const shared_item&) = delete;
+    shared_item& operator=(const shared_item&) = delete;
+
+    T value;
+    std::atomic<std::size_t> readers;
+    memory_budget* const budget;
+    const std::size_t charged;
+};
+
+// An item in flight on a link.
+// A single-consumer link owns its item outright. When a stage fans out to several
+// links the item is published once into a shared slot and every branch holds a reference
+// to it, so no branch pays for a copy unless it has to own the item. Branches only read the
+// slot; once the others are done with it, the last one to take() it moves the item out.
+// Items that are shared handles themselves (envelopes) are copied to every branch instead.
+template <typename T>
+class message {
+public:
+    message() = default;
+    explicit message(T value) : item_(std::in_place_index<1>, std::move(value)) {}
+    // One of the readers the slot was created for
+    explicit message(std::shared_ptr<shared_item<T>> shared) : item_(std::in_place_index<2>, std::move(shared)) {}
+
+    // A copy of a handle for one more branch; only the message of the last branch accounts
+    // for what the handle points to
+    static message extra_handle(T value) {
+        message m;
+        m.item_.template emplace<3>(handle{std::move(value)});
+        return m;
+    }
+
+    message(message&& other) noexcept : item_(std::exchange(other.item_, {})) {}
+    message& operator=(message&& other) noexcept {
+        if (this != &other) {
+            drop();
+            item_ = std::exchange(other.item_, {});
+        }
+        return *this;
+    }
+    ~message() { drop(); }
+
+    bool shared() const { return item_.index() == 2; }
+    bool extra_handle() const { return item_.index() == 3; }
+
+    // Read-only access; never copies
+    const T& get() const {
+        switch (item_.index()) {
+        case 1: return std::get<1>(item_);
+        case 2: return std::get<2>(item_)->value;
+        default: return std::get<3>(item_).value;
+        }
+    }
+
+    // Takes ownership of the item: moves it out if this message owns it or is the last
+    // reader of the shared slot, copies it otherwise
+    T take() {
+        if (item_.index() == 1) return std::move(std::get<1>(item_));
+        if (item_.index() == 3) return std::move(std::get<3>(item_).value);
+
+        auto& shared = *std::get<2>(item_);
+        // Pairs with the release in the other readers' drop(), after their last access
+        if (shared.readers.load(std::memory_order_acquire) == 1) return std::move(shared.value);
+        return shared.value;
+    }
+
+private:
+    void drop() {
+        if (item_.index() == 2) std::get<2>(item_)->readers.fetch_sub(1, std::memory_order_release);
+        item_ = {};
+    }
+
+    struct handle {
+        T value;
+    };
+
+    std::variant<std::monostate, T, std::shared_ptr<shared_item<T>>, handle> item_;
+};
+
+// A fanned-out item is charged once, by its shared slot or by the last branch's handle
+template <typename T>
+struct payload_size<message<T>> {
+    std::size_t operator()(const message<T>& m) const {
+        if (m.shared()) return 0;
+        if (m.extra_handle()) return sizeof(T);
+        return payload_size<T>()(m.get());
+    }
+};
+
+template <typename T>
+struct spill_codec<message<T>, std::enable_if_t<spillable<T>>> {
+    static void encode(message<T>&& m, std::string& out) { spill_codec<T>::encode(m.take(), out); }
+    static message<T> decode(std::string_view in) { return message<T>(spill_codec<T>::decode(in)); }
+};
+
+} // namespace pipef
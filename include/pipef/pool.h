@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "topology.h"
+
+namespace pipef {
+
+// Recycles storage for objects of type T.
+// Each thread allocates from and frees into its own cache, so the common case
+// (a payload created and dropped by stages on the same workers) takes no lock.
+// Caches trade half their slots with a shared list in batches when they run dry
+// or grow past cache_limit, and new slabs of slab_size slots are only carved out
+// when the shared list is empty. Memory is kept for reuse, never returned to the system.
+// There is one shared list per NUMA node, picked by the node the calling thread is bound
+// to (see numa_topology::current_node): workers reuse slots released on their own node
+// and carve new slabs, first touched there, when that node's list is empty.
+template <typename T>
+class slab_pool {
+public:
+    static constexpr std::size_t slab_size = 64;
+    static constexpr std::size_t cache_limit = 128;
+
+    // Never destroyed: thread caches hand their slots back on thread exit, possibly after static destruction
+    static slab_pool& instance() {
+        static slab_pool* pool = new slab_pool;
+        return *pool;
+    }
+
+    void* allocate() {
+        cache& c = local();
+        if (!c.free.head) refill(c);
+        slot* s = c.free.head;
+        c.free.head = s->next;
+        --c.free.count;
+        return s->storage;
+    }
+
+    void deallocate(void* p) {
+        cache& c = local();
+        auto* s = static_cast<slot*>(p);
+        s->next = c.free.head;
+        c.free.head = s;
+        if (++c.free.count > cache_limit) spill(c, cache_limit / 2);
+    }
+
+    slab_pool(const slab_pool&) = delete;
+    slab_pool& operator=(const slab_pool&) = delete;
+
+private:
+    union slot {
+        slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct chain {
+        slot* head = nullptr;
+        std::size_t count = 0;
+    };
+
+    struct cache {
+        chain free;
+        ~cache() {
+            if (free.head) instance().spill(*this, free.count);
+        }
+    };
+
+    slab_pool() = default;
+
+    static cache& local() {
+        thread_local cache c;
+        return c;
+    }
+
+    void refill(cache& c) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& list = shared_list();
+            if (!list.empty()) {
+                c.free = list.back();
+                list.pop_back();
+                return;
+            }
+        }
+        std::unique_ptr<slot[]> slab(new slot[slab_size]);
+        for (std::size_t i = 0; i + 1 < slab_size; ++i) slab[i].next = &slab[i + 1];
+        slab[slab_size - 1].next = nullptr;
+        c.free = {slab.get(), slab_size};
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        slabs_.push_back(std::move(slab));
+    }
+
+    // Moves the first `n` cached slots to the shared list as one batch
+    void spill(cache& c, std::size_t n) {
+        chain batch{c.free.head, n};
+        slot* last = c.free.head;
+        for (std::size_t i = 1; i < n; ++i) last = last->next;
+        c.free.head = last->next;
+        c.free.count -= n;
+        last->next = nullptr;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        shared_list().push_back(batch);
+    }
+
+    // The calling thread's node's shared list; called with mutex_ held
+    std::vector<chain>& shared_list() {
+        std::size_t node = numa_topology::current_node();
+        if (node >= shared_.size()) shared_.resize(node + 1);
+        return shared_[node];
+    }
+
+    std::mutex mutex_;
+    std::vector<std::vector<chain>> shared_; // by NUMA node
+    std::vector<std::unique_ptr<slot[]>> slabs_;
+};
+
+// Allocator drawing single objects from slab_pool; larger requests go to the global heap
+template <typename T>
+struct pool_allocator {
+    using value_type = T;
+
+    pool_allocator() noexcept = default;
+    template <typename U>
+    pool_allocator(const pool_allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (n != 1) return std::allocator<T>().allocate(n);
+        return static_cast<T*>(slab_pool<T>::instance().allocate());
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        if (n != 1) return std::allocator<T>().deallocate(p, n);
+        slab_pool<T>::instance().deallocate(p);
+    }
+
+    template <typename U>
+    bool operator==(const pool_allocator<U>&) const noexcept { return true; }
+};
+
+// Like std::make_shared, but the object and its reference count live in a recycled pool slot
+// that goes back to the pool when the last reference (typically held by a sink) is dropped
+template <typename T, typename... Args>
+std::shared_ptr<T> make_pooled(Args&&... args) {
+    return std::allocate_shared<T>(pool_allocator<T>(), std::forward<Args>(args)...);
+}
+
+} // namespace pipef
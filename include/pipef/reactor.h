@@ -0,0 +1,302 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "coroutine.h"
+
+namespace pipef {
+
+// Receives readiness of a descriptor
+class io_handler {
+public:
+    virtual ~io_handler() = default;
+
+    // Called once per watch(), on whichever thread observed the readiness;
+    // `events` uses the EPOLL* bits, with EPOLLHUP alone meaning the watch was cancelled
+    virtual void on_ready(std::uint32_t events) = 0;
+};
+
+// Delivers descriptor readiness: the built-in epoll reactor, or an external event loop.
+// A descriptor can have one pending reader (EPOLLIN) and one pending writer (EPOLLOUT) at a time.
+class io_watcher {
+public:
+    virtual ~io_watcher() = default;
+
+    // Calls h->on_ready() once `fd` is readable (EPOLLIN) or writable (EPOLLOUT)
+    virtual void watch(int fd, std::uint32_t events, io_handler* h) = 0;
+    // Cancels pending watches on `fd`, which is about to be closed
+    virtual void cancel(int fd) = 0;
+    // Drops the pending watch of `h` on `fd`, if any, without calling it; once this returns
+    // `h` is not being called either, so it can be destroyed
+    virtual void unwatch(int fd, io_handler* h) = 0;
+    // Cancels pending watches on `fd` and closes it
+    virtual void close(int fd) {
+        cancel(fd);
+        ::close(fd);
+    }
+
+    // The watcher stages on the calling thread should use
+    static io_watcher& current();
+
+    // Set by external event loops for the thread they run stages on
+    static io_watcher*& thread_override() {
+        thread_local io_watcher* watcher = nullptr;
+        return watcher;
+    }
+};
+
+// Process-wide epoll thread used when the engine runs on its own workers.
+// Each watch remembers the scheduler whose worker armed it, so engine::run can cancel
+// the watches of its own stages when it returns.
+class reactor : public io_watcher {
+public:
+    static reactor& instance() {
+        static reactor r;
+        return r;
+    }
+
+    // The reactor if something has used it, without starting its thread otherwise
+    static reactor* existing() { return started().load(std::memory_order_acquire); }
+
+    void watch(int fd, std::uint32_t events, io_handler* h) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& e = entries_[fd];
+        waiter& target = (events & EPOLLIN) ? e.reader : e.writer;
+        target = {h, scheduler::current()};
+        if (!arm(fd, e)) {
+            int err = errno;
+            target = {};
+            throw std::system_error(err, std::generic_category(), "epoll_ctl");
+        }
+    }
+
+    void cancel(int fd) override {
+        io_handler* reader = nullptr;
+        io_handler* writer = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = entries_.find(fd);
+            if (it == entries_.end()) return;
+            reader = it->second.reader.handler;
+            writer = it->second.writer.handler;
+            entries_.erase(it);
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        if (reader) reader->on_ready(EPOLLHUP);
+        if (writer) writer->on_ready(EPOLLHUP);
+    }
+
+    void unwatch(int fd, io_handler* h) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = entries_.find(fd);
+        if (it != entries_.end()) {
+            if (it->second.reader.handler == h) it->second.reader = {};
+            if (it->second.writer.handler == h) it->second.writer = {};
+            rearm(it);
+        }
+        wait_for_dispatch(lock);
+    }
+
+    // Cancels every watch armed from the workers of `owner`, waking its handler with EPOLLHUP
+    void cancel_all(const scheduler& owner) {
+        std::vector<io_handler*> handlers;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (auto it = entries_.begin(); it != entries_.end();) {
+                auto next = std::next(it);
+                for (waiter* w : {&it->second.reader, &it->second.writer}) {
+                    if (w->handler && w->owner == &owner) handlers.push_back(std::exchange(*w, {}).handler);
+                }
+                rearm(it);
+                it = next;
+            }
+            wait_for_dispatch(lock);
+        }
+        for (io_handler* h : handlers) h->on_ready(EPOLLHUP);
+    }
+
+    reactor(const reactor&) = delete;
+    reactor& operator=(const reactor&) = delete;
+
+private:
+    struct waiter {
+        io_handler* handler = nullptr;
+        const scheduler* owner = nullptr;
+    };
+
+    struct entry {
+        waiter reader;
+        waiter writer;
+        bool registered = false;
+    };
+
+    static std::atomic<reactor*>& started() {
+        static std::atomic<reactor*> r{nullptr};
+        return r;
+    }
+
+    reactor() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (epoll_fd_ < 0 || stop_fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), "reactor");
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = stop_fd_;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &ev);
+        thread_ = std::thread([this] { loop(); });
+        started().store(this, std::memory_order_release);
+    }
+
+    ~reactor() {
+        started().store(nullptr, std::memory_order_release);
+        std::uint64_t one = 1;
+        [[maybe_unused]] auto n = ::write(stop_fd_, &one, sizeof(one));
+        thread_.join();
+        ::close(stop_fd_);
+        ::close(epoll_fd_);
+    }
+
+    // Arms one-shot interest for whichever of reader and writer are pending
+    bool arm(int fd, entry& e) {
+        if (!e.reader.handler && !e.writer.handler) return true;
+        epoll_event ev{};
+        ev.events = EPOLLONESHOT | (e.reader.handler ? EPOLLIN | EPOLLRDHUP : 0u)
+            | (e.writer.handler ? EPOLLOUT : 0u);
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd_, e.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) != 0) return false;
+        e.registered = true;
+        return true;
+    }
+
+    // After a watch was dropped: forgets the descriptor once nothing waits on it, else re-arms it
+    void rearm(std::unordered_map<int, entry>::iterator it) {
+        if (it->second.reader.handler || it->second.writer.handler) {
+            arm(it->first, it->second);
+            return;
+        }
+        if (it->second.registered) epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->first, nullptr);
+        entries_.erase(it);
+    }
+
+    // Handlers taken by dispatch() are called without the lock; waits until they have returned,
+    // unless called by one of them
+    void wait_for_dispatch(std::unique_lock<std::mutex>& lock) {
+        if (std::this_thread::get_id() == thread_.get_id()) return;
+        dispatched_.wait(lock, [this] { return !dispatching_; });
+    }
+
+    void loop() {
+        epoll_event events[64];
+        for (;;) {
+            int n = epoll_wait(epoll_fd_, events, 64, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == stop_fd_) return;
+                dispatch(fd, events[i].events);
+            }
+        }
+    }
+
+    void dispatch(int fd, std::uint32_t events) {
+        io_handler* reader = nullptr;
+        io_handler* writer = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = entries_.find(fd);
+            if (it == entries_.end()) return;
+            auto& e = it->second;
+            bool failed = events & (EPOLLERR | EPOLLHUP);
+            if (e.reader.handler && (failed || (events & (EPOLLIN | EPOLLRDHUP)))) {
+                reader = std::exchange(e.reader, {}).handler;
+            }
+            if (e.writer.handler && (failed || (events & EPOLLOUT))) writer = std::exchange(e.writer, {}).handler;
+            arm(fd, e);
+            dispatching_ = reader || writer;
+        }
+        if (reader) reader->on_ready(events);
+        if (writer) writer->on_ready(events);
+        if (reader || writer) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            dispatching_ = false;
+            dispatched_.notify_all();
+        }
+    }
+
+    int epoll_fd_ = -1;
+    int stop_fd_ = -1;
+    std::mutex mutex_;
+    std::condition_variable dispatched_;
+    bool dispatching_ = false;
+    std::unordered_map<int, entry> entries_;
+    std::thread thread_;
+};
+
+inline io_watcher& io_watcher::current() {
+    io_watcher* w = thread_override();
+    return w ? *w : reactor::instance();
+}
+
+// Awaitable that suspends a coroutine stage until a descriptor is ready;
+// co_await yields the EPOLL* bits that were reported
+// A coroutine destroyed while parked (e.g. with its engine after a run) drops its watch.
+struct fd_awaiter : event_awaiter, io_handler {
+    int fd;
+    std::uint32_t events;
+    std::uint32_t reported = 0;
+    coroutine_slot* slot = nullptr;
+    std::atomic<io_watcher*> watcher{nullptr}; // while the watch is pending
+
+    fd_awaiter(int fd, std::uint32_t events) : fd(fd), events(events) {}
+
+    ~fd_awaiter() override {
+        if (io_watcher* w = watcher.exchange(nullptr, std::memory_order_acq_rel)) w->unwatch(fd, this);
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        slot = &park(h);
+        io_watcher& w = io_watcher::current();
+        watcher.store(&w, std::memory_order_release);
+        try {
+            w.watch(fd, events, this);
+        } catch (...) {
+            watcher.store(nullptr, std::memory_order_relaxed);
+            slot->release();
+            throw;
+        }
+    }
+
+    std::uint32_t await_resume() const noexcept { return reported; }
+
+    void on_ready(std::uint32_t ev) override {
+        reported = ev;
+        watcher.store(nullptr, std::memory_order_release);
+        slot->wake();
+    }
+};
+
+// co_await wait_readable(fd) in a coroutine stage parks it until `fd` can be read
+inline fd_awaiter wait_readable(int fd) { return {fd, EPOLLIN}; }
+
+// co_await wait_writable(fd) in a coroutine stage parks it until `fd` can be written
+inline fd_awaiter wait_writable(int fd) { return {fd, EPOLLOUT}; }
+
+} // namespace pipef
@@ -0,0 +1,490 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "topology.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace pipef {
+
+class scheduler;
+class memory_budget;
+
+// How an idle worker waits for the next task: busy-spin, then yield, then park.
+// Spinning hands items over without a futex wake-up, but burns the core while idle,
+// so it only pays off when the deployment has cores to dedicate to the engine.
+struct wait_strategy {
+    std::chrono::nanoseconds spin{0};
+    std::chrono::nanoseconds yield{0};
+
+    // Parks as soon as there is nothing to run; the default
+    static wait_strategy park() { return {}; }
+
+    static wait_strategy spin_then_park(std::chrono::nanoseconds spin = std::chrono::microseconds(50),
+                                        std::chrono::nanoseconds yield = std::chrono::microseconds(200)) {
+        return {spin, yield};
+    }
+};
+
+// Hint to the CPU that the caller is busy-waiting
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Base class of every pipeline stage.
+// A stage runs as a task on the scheduler; at most one invocation of a given
+// stage is queued or running at any time, so stage bodies never race with themselves.
+class node {
+public:
+    virtual ~node() = default;
+
+    // Schedules the stage, or asks a running invocation to go round once more
+    void notify();
+
+    // Keeps engine::run going while the stage waits for an event from outside the scheduler,
+    // such as a parked coroutine waiting for I/O; each hold() is matched by one release()
+    void hold();
+    void release();
+
+    // Overrides the engine's wait strategy for a worker that has just run this stage,
+    // e.g. to spin only after latency-critical stages
+    void set_wait_strategy(wait_strategy w) { wait_ = w; }
+
+    // Prefers workers on NUMA node `numa_node` for this stage and binds its input rings there;
+    // only has an effect once the engine's NUMA placement is on
+    void set_numa_node(std::size_t numa_node) { numa_node_ = static_cast<int>(numa_node); }
+    int numa_node() const { return numa_node_; }
+
+    // The engine's memory budget, if it was created with one
+    memory_budget* budget() const { return budget_; }
+
+protected:
+    node() = default;
+    // For internal tasks whose links count against their owner's memory budget
+    explicit node(memory_budget* budget) : budget_(budget) {}
+
+    // Processes up to `budget` items (batches, for the batched stages in batch.h)
+    virtual void step(std::size_t budget) = 0;
+    // Whether a call to step() could make progress right now; only called by the stage's owner
+    virtual bool ready() const = 0;
+    // Called by engine::run before the first task is scheduled
+    virtual void start(int /* loop_count */) {}
+    // Called by engine::run once every stage has started; merges this stage with its successor if possible
+    virtual void fuse() {}
+    // Makes `head` the producer of every link this stage (or the chain fused after it) pushes into
+    virtual void adopt_outputs(node* /* head */) {}
+    // Internal tasks owned by this stage that the engine must schedule alongside it
+    virtual std::vector<node*> helpers() { return {}; }
+    // Moves the memory of this stage's input links to `numa_node`
+    virtual void place_inputs(std::size_t /* numa_node */) {}
+
+    // Sources check this before producing; false while the engine's memory budget is used up
+    bool within_budget() const;
+
+    bool absorbed_ = false; // runs inline inside its predecessor's step
+
+private:
+    friend class scheduler;
+    friend class engine;
+
+    enum state : int { idle, queued, running, rerun };
+
+    scheduler* sched_ = nullptr;
+    std::atomic<int> state_{idle};
+    std::optional<wait_strategy> wait_;
+    int numa_node_ = -1;
+    memory_budget* budget_ = nullptr;
+};
+
+// Work-stealing task scheduler.
+// Each worker owns a deque: it pushes and pops newly woken stages at the back,
+// while idle workers steal from the front of other workers' deques. Stages that
+// used up their budget are requeued on a shared FIFO so they cannot starve
+// the downstream stages they just fed.
+// With NUMA placement on, workers are pinned to nodes in contiguous blocks and stages
+// with a NUMA hint are queued for workers of their node; other nodes only take them
+// once they have nothing else to do.
+class scheduler {
+public:
+    static constexpr std::size_t task_budget = 64;
+
+    explicit scheduler(std::size_t worker_count)
+        : queues_(worker_count == 0 ? 1 : worker_count) {}
+
+    std::size_t worker_count() const { return queues_.size(); }
+
+    // Scheduler whose worker (or poll()) is running on the calling thread, if any
+    static scheduler* current() { return current_owner(); }
+
+    // Applies to the next run()
+    void set_wait_strategy(wait_strategy w) { wait_ = w; }
+
+    // Applies to the next run(); ignored on machines with a single NUMA node
+    void set_numa_placement(bool on) {
+        const numa_topology& topology = numa_topology::system();
+        if (!on || topology.nodes() < 2) {
+            numa_ = nullptr;
+            numa_queues_.clear();
+            return;
+        }
+        numa_ = &topology;
+        numa_queues_ = std::vector<worker_queue>(topology.nodes());
+        worker_node_.resize(queues_.size());
+        for (std::size_t i = 0; i < queues_.size(); ++i) worker_node_[i] = i * topology.nodes() / queues_.size();
+    }
+
+    bool numa_placement() const { return numa_ != nullptr; }
+
+    // Runs until every stage is idle or the deadline expires; rethrows the first stage error
+    void run(const std::vector<node*>& nodes, std::chrono::steady_clock::time_point deadline) {
+        begin(nodes, deadline);
+        work();
+        finish(nodes);
+    }
+
+    // The worker part of run(), between begin() and finish(): returns once the workers have stopped
+    void work() {
+        std::vector<std::thread> threads;
+        threads.reserve(queues_.size() - 1);
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+            threads.emplace_back([this, i] {
+                if (numa_) numa_->bind_thread(worker_node_[i]);
+                worker_loop(i);
+            });
+        }
+
+        // The calling thread is worker 0; it gets its own affinity back afterwards
+        cpu_set_t caller_cpus;
+        bool rebind = numa_ && pthread_getaffinity_np(pthread_self(), sizeof(caller_cpus), &caller_cpus) == 0;
+        if (rebind) numa_->bind_thread(worker_node_[0]);
+        worker_loop(0);
+        if (rebind) {
+            pthread_setaffinity_np(pthread_self(), sizeof(caller_cpus), &caller_cpus);
+            numa_topology::unbind_thread();
+        }
+
+        for (auto& t : threads) t.join();
+    }
+
+    // External event loops drive the scheduler with begin(), poll() and finish() instead of run()
+    void begin(const std::vector<node*>& nodes, std::chrono::steady_clock::time_point deadline) {
+        stop_.store(false, std::memory_order_relaxed);
+        error_ = nullptr;
+        deadline_ = deadline;
+        for (node* n : nodes) {
+            if (n->ready()) n->notify();
+        }
+    }
+
+    // Runs up to `max_tasks` queued tasks on the calling thread; returns how many ran
+    std::size_t poll(std::size_t max_tasks) {
+        current_owner() = this;
+        current_index() = 0;
+        std::size_t ran = 0;
+        while (ran < max_tasks && !stop_.load(std::memory_order_acquire)) {
+            node* task = next_task(0);
+            if (!task) break;
+            execute(task);
+            ++ran;
+        }
+        current_owner() = nullptr;
+        return ran;
+    }
+
+    // Whether the run is over: stopped, past the deadline, or out of work with nothing parked
+    bool finished() const {
+        return stop_.load(std::memory_order_acquire)
+            || std::chrono::steady_clock::now() >= deadline_
+            || (pending_.load(std::memory_order_acquire) == 0
+                && outstanding_.load(std::memory_order_acquire) == 0);
+    }
+
+    std::chrono::steady_clock::time_point deadline() const { return deadline_; }
+
+    // Called whenever a stage is queued from outside the scheduler's own threads
+    void set_waker(std::function<void()> waker) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        waker_ = std::move(waker);
+    }
+
+    void finish(const std::vector<node*>& nodes) {
+        // Drop whatever is still queued when the deadline cut the run short
+        for (auto& q : queues_) q.tasks.clear();
+        for (auto& q : numa_queues_) q.tasks.clear();
+        injected_.clear();
+        for (node* n : nodes) n->state_.store(node::idle, std::memory_order_relaxed);
+        pending_.store(0, std::memory_order_relaxed);
+        // Waits parked past the deadline have been cancelled by the caller, see engine::run
+        outstanding_.store(0, std::memory_order_relaxed);
+
+        if (error_) std::rethrow_exception(error_);
+    }
+
+    // Queues a stage on the calling worker's deque, or on the shared queue from outside
+    void schedule(node* n) {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        enqueue(n);
+    }
+
+private:
+    friend class node;
+
+    struct alignas(64) worker_queue {
+        std::mutex mutex;
+        std::deque<node*> tasks;
+    };
+
+    void enqueue(node* n) {
+        if (current_owner() == this && (!placed(n) || home(n) == worker_node_[current_index()])) {
+            auto& q = queues_[current_index()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(n);
+        } else {
+            push_shared(n);
+        }
+        wake_one();
+        if (current_owner() != this) {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            if (waker_) waker_();
+        }
+    }
+
+    bool placed(const node* n) const { return numa_ && n->numa_node_ >= 0; }
+    std::size_t home(const node* n) const { return static_cast<std::size_t>(n->numa_node_) % numa_queues_.size(); }
+
+    // Shared FIFO for tasks queued from outside, requeued, or bound to another NUMA node
+    void push_shared(node* n) {
+        if (placed(n)) {
+            auto& q = numa_queues_[home(n)];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(n);
+        } else {
+            std::lock_guard<std::mutex> lock(injected_mutex_);
+            injected_.push_back(n);
+        }
+    }
+
+    static node* pop_front(worker_queue& q) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) return nullptr;
+        node* n = q.tasks.front();
+        q.tasks.pop_front();
+        return n;
+    }
+
+    static scheduler*& current_owner() {
+        thread_local scheduler* owner = nullptr;
+        return owner;
+    }
+
+    static std::size_t& current_index() {
+        thread_local std::size_t index = 0;
+        return index;
+    }
+
+    void worker_loop(std::size_t index) {
+        current_owner() = this;
+        current_index() = index;
+        const wait_strategy* strategy = &wait_;
+
+        while (!stop_.load(std::memory_order_acquire)) {
+            if (std::chrono::steady_clock::now() >= deadline_) {
+                request_stop();
+                break;
+            }
+            std::uint64_t seen = signals_.load(std::memory_order_acquire);
+            if (node* task = next_task(index)) {
+                strategy = task->wait_ ? &*task->wait_ : &wait_;
+                execute(task);
+                continue;
+            }
+            if (pending_.load(std::memory_order_acquire) == 0
+                && outstanding_.load(std::memory_order_acquire) == 0) break;
+            if (spin_for_work(*strategy, seen)) continue;
+
+            // Sleeps until notified, e.g. by a parked wait ending, or until the deadline; checked again
+            // under the lock, since a task queued since `seen` does not notify a worker not yet idle
+            auto woken = [&] {
+                return signals_.load(std::memory_order_acquire) != seen || stop_.load(std::memory_order_acquire);
+            };
+            std::unique_lock<std::mutex> lock(idle_mutex_);
+            ++idle_;
+            if (deadline_ == std::chrono::steady_clock::time_point::max()) {
+                idle_cv_.wait(lock, woken);
+            } else {
+                idle_cv_.wait_until(lock, deadline_, woken);
+            }
+            --idle_;
+        }
+
+        current_owner() = nullptr;
+        wake_all();
+    }
+
+    // Busy-waits, then yields, until something is queued after `seen`; false once the strategy gives up
+    bool spin_for_work(const wait_strategy& w, std::uint64_t seen) {
+        if (w.spin.count() <= 0 && w.yield.count() <= 0) return false;
+        auto now = std::chrono::steady_clock::now();
+        auto spin_end = now + w.spin;
+        auto yield_end = spin_end + w.yield;
+        for (unsigned i = 1;; ++i) {
+            if (signals_.load(std::memory_order_acquire) != seen || stop_.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            // Reading the clock costs more than a pause, so only check it every few rounds
+            if (i % 64 == 0) now = std::chrono::steady_clock::now();
+            if (now >= yield_end) return false;
+            if (now < spin_end) {
+                cpu_relax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    node* next_task(std::size_t index) {
+        {
+            auto& own = queues_[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                node* n = own.tasks.back();
+                own.tasks.pop_back();
+                return n;
+            }
+        }
+        if (numa_) {
+            if (node* n = pop_front(numa_queues_[worker_node_[index]])) return n;
+        }
+        {
+            std::lock_guard<std::mutex> lock(injected_mutex_);
+            if (!injected_.empty()) {
+                node* n = injected_.front();
+                injected_.pop_front();
+                return n;
+            }
+        }
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+            if (node* n = pop_front(queues_[(index + i) % queues_.size()])) return n;
+        }
+        // Better a remote worker than an idle one
+        for (auto& q : numa_queues_) {
+            if (node* n = pop_front(q)) return n;
+        }
+        return nullptr;
+    }
+
+    void execute(node* n) {
+        n->state_.store(node::running, std::memory_order_seq_cst);
+        try {
+            n->step(task_budget);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            if (!error_) error_ = std::current_exception();
+            stop_.store(true, std::memory_order_release);
+        }
+
+        // A stage that still has work, or was notified while running, goes to the back of the shared queue
+        int expected = node::running;
+        bool more = !stop_.load(std::memory_order_relaxed) && n->ready();
+        if (more || !n->state_.compare_exchange_strong(expected, node::idle, std::memory_order_seq_cst)) {
+            n->state_.store(node::queued, std::memory_order_relaxed);
+            push_shared(n);
+            wake_one();
+            return;
+        }
+
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) wake_all();
+    }
+
+    void request_stop() {
+        stop_.store(true, std::memory_order_release);
+        wake_all();
+    }
+
+    // Spinning workers watch signals_; parked ones wait on the condition variable
+    void wake_one() {
+        signals_.fetch_add(1, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        if (idle_ > 0) idle_cv_.notify_one();
+    }
+
+    void wake_all() {
+        signals_.fetch_add(1, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        idle_cv_.notify_all();
+    }
+
+    std::vector<worker_queue> queues_;
+    std::mutex injected_mutex_;
+    std::deque<node*> injected_;
+
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    std::size_t idle_ = 0;
+    std::function<void()> waker_;
+    wait_strategy wait_;
+    alignas(64) std::atomic<std::uint64_t> signals_{0};
+
+    const numa_topology* numa_ = nullptr;
+    std::vector<std::size_t> worker_node_;
+    std::vector<worker_queue> numa_queues_;
+
+    std::atomic<std::size_t> pending_{0};
+    std::atomic<std::size_t> outstanding_{0};
+    std::atomic<bool> stop_{false};
+    std::chrono::steady_clock::time_point deadline_;
+    std::exception_ptr error_;
+};
+
+inline void node::notify() {
+    if (!sched_) return;
+    // Pairs with the state transitions in scheduler::execute so a freshly published item is never missed
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int s = state_.load(std::memory_order_relaxed);
+    for (;;) {
+        if (s == queued || s == rerun) return;
+        if (s == idle) {
+            if (state_.compare_exchange_weak(s, queued, std::memory_order_seq_cst)) {
+                sched_->schedule(this);
+                return;
+            }
+        } else if (state_.compare_exchange_weak(s, rerun, std::memory_order_seq_cst)) {
+            return;
+        }
+    }
+}
+
+inline void node::hold() {
+    if (sched_) sched_->outstanding_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+inline void node::release() {
+    if (!sched_) return;
+    // Never below zero: finish() forgets the waits of a run, and one may still end late
+    auto& outstanding = sched_->outstanding_;
+    std::size_t n = outstanding.load(std::memory_order_acquire);
+    while (n > 0 && !outstanding.compare_exchange_weak(n, n - 1, std::memory_order_acq_rel)) {}
+    // The last wait of an otherwise idle run: parked workers have to see that it is over
+    if (n == 1 && sched_->pending_.load(std::memory_order_acquire) == 0) sched_->wake_all();
+}
+
+} // namespace pipef
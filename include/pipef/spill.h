@@ -0,0 +1,196 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace pipef {
+
+// Converts items to bytes and back for links that spill to disk (see overflow::spill).
+// Specialize for your own payload types. Records are only ever read back by the process
+// that wrote them, so a codec may store pointers, e.g. to keep a connection alive.
+template <typename T, typename = void>
+struct spill_codec;
+
+template <typename T>
+struct spill_codec<T, std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+    static void encode(T&& item, std::string& out) {
+        out.append(reinterpret_cast<const char*>(&item), sizeof(T));
+    }
+    static T decode(std::string_view in) {
+        T item;
+        std::memcpy(&item, in.data(), sizeof(T));
+        return item;
+    }
+};
+
+template <typename C, typename Tr, typename A>
+struct spill_codec<std::basic_string<C, Tr, A>> {
+    static void encode(std::basic_string<C, Tr, A>&& item, std::string& out) {
+        out.append(reinterpret_cast<const char*>(item.data()), item.size() * sizeof(C));
+    }
+    static std::basic_string<C, Tr, A> decode(std::string_view in) {
+        return std::basic_string<C, Tr, A>(reinterpret_cast<const C*>(in.data()), in.size() / sizeof(C));
+    }
+};
+
+template <typename U, typename A>
+struct spill_codec<std::vector<U, A>, std::enable_if_t<std::is_trivially_copyable_v<U>>> {
+    static void encode(std::vector<U, A>&& item, std::string& out) {
+        out.append(reinterpret_cast<const char*>(item.data()), item.size() * sizeof(U));
+    }
+    static std::vector<U, A> decode(std::string_view in) {
+        std::vector<U, A> item(in.size() / sizeof(U));
+        std::memcpy(item.data(), in.data(), item.size() * sizeof(U));
+        return item;
+    }
+};
+
+// Whether items of type T can go through a spilling link
+template <typename T>
+concept spillable = requires(T&& item, std::string& out, std::string_view in) {
+    spill_codec<T>::encode(std::move(item), out);
+    { spill_codec<T>::decode(in) } -> std::same_as<T>;
+};
+
+// Append-only record log behind a spilling link, one writer and one reader.
+// Records go into fixed-size segments: unlinked temporary files mapped into memory,
+// so a spilled backlog lives in the page cache (and on disk under memory pressure)
+// instead of the heap. A segment is dropped as soon as the reader has gone past it.
+class spill_log {
+public:
+    static constexpr std::size_t segment_size = 8 * 1024 * 1024;
+
+    explicit spill_log(std::string directory)
+        : directory_(directory.empty() ? std::filesystem::temp_directory_path().string() : std::move(directory)) {}
+
+    ~spill_log() {
+        for (auto& s : segments_) unmap(s);
+    }
+
+    spill_log(const spill_log&) = delete;
+    spill_log& operator=(const spill_log&) = delete;
+
+    // Records appended and not yet read
+    std::size_t size() const {
+        return appended_.load(std::memory_order_acquire) - consumed_.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+
+    // Writer side
+    void append(std::string_view record) {
+        std::size_t need = header + record.size();
+        if (!write_ || write_->size - write_offset_ < need + header) { // keep room for the seal
+            if (write_) seal();
+            write_ = open_segment(need + header);
+            write_offset_ = 0;
+        }
+        std::uint32_t length = static_cast<std::uint32_t>(record.size());
+        std::memcpy(write_->data + write_offset_, &length, header);
+        std::memcpy(write_->data + write_offset_ + header, record.data(), record.size());
+        write_offset_ += need;
+        appended_.fetch_add(1, std::memory_order_release);
+    }
+
+    // Reader side: the next record, valid until the following call; only call when !empty()
+    std::string_view read() {
+        if (!read_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            read_ = &segments_.front();
+            read_offset_ = 0;
+        }
+        std::uint32_t length;
+        std::memcpy(&length, read_->data + read_offset_, header);
+        if (length == sealed) {
+            // The writer moved on; it published the next segment before the record we are owed
+            std::lock_guard<std::mutex> lock(mutex_);
+            unmap(segments_.front());
+            segments_.pop_front();
+            read_ = &segments_.front();
+            read_offset_ = 0;
+            std::memcpy(&length, read_->data, header);
+        }
+        std::string_view record(read_->data + read_offset_ + header, length);
+        read_offset_ += header + length;
+        consumed_.fetch_add(1, std::memory_order_release);
+        return record;
+    }
+
+private:
+    static constexpr std::size_t header = sizeof(std::uint32_t);
+    static constexpr std::uint32_t sealed = 0xffffffff;
+
+    struct segment {
+        char* data;
+        std::size_t size;
+    };
+
+    // Marks the end of the current segment and lets the kernel write its pages back
+    // and reclaim them; the reader faults them in again from the page cache or disk
+    void seal() {
+        std::memcpy(write_->data + write_offset_, &sealed, header);
+        ::madvise(write_->data, write_->size, MADV_DONTNEED);
+    }
+
+    segment* open_segment(std::size_t min_size) {
+        std::size_t size = min_size > segment_size ? min_size : segment_size;
+        int fd = -1;
+#ifdef O_TMPFILE
+        fd = ::open(directory_.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+        if (fd < 0) {
+            std::string path = directory_ + "/pipef-spill-XXXXXX";
+            fd = ::mkostemp(path.data(), O_CLOEXEC);
+            if (fd < 0) throw std::system_error(errno, std::generic_category(), "pipef: spill file");
+            ::unlink(path.c_str());
+        }
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "pipef: spill file");
+        }
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int error = errno;
+        ::close(fd); // the mapping keeps the file alive
+        if (p == MAP_FAILED) throw std::system_error(error, std::generic_category(), "pipef: spill mmap");
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        segments_.push_back({static_cast<char*>(p), size});
+        return &segments_.back();
+    }
+
+    static void unmap(segment& s) { ::munmap(s.data, s.size); }
+
+    const std::string directory_;
+
+    std::mutex mutex_; // guards segments_ when a segment is added or dropped
+    std::deque<segment> segments_;
+
+    // Writer-owned
+    segment* write_ = nullptr;
+    std::size_t write_offset_ = 0;
+    alignas(64) std::atomic<std::size_t> appended_{0};
+
+    // Reader-owned
+    alignas(64) segment* read_ = nullptr;
+    std::size_t read_offset_ = 0;
+    std::atomic<std::size_t> consumed_{0};
+};
+
+} // namespace pipef
@@ -0,0 +1,596 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "callable.h"
+#include "channel.h"
+#include "coroutine.h"
+#include "envelope.h"
+#include "function.h"
+#include "message.h"
+#include "pool.h"
+#include "scheduler.h"
+
+namespace pipef {
+
+// A link carrying items of type T
+template <typename T>
+using link = channel<message<T>>;
+
+// Implemented by stages that an upstream stage may call directly instead of going through a link
+template <typename T>
+class fused_input {
+public:
+    virtual ~fused_input() = default;
+
+    // Whether the stage's only input is a plain link that can be bypassed
+    virtual bool fusible() const = 0;
+    virtual void mark_absorbed() = 0;
+    virtual void consume_fused(T item) = 0;
+    virtual bool writable_fused() const = 0;
+    virtual void adopt_fused(node* head) = 0;
+};
+
+// Downstream side of a stage.
+// With one link the item is moved into it; with several it is published once
+// into a shared read-only slot, drawn from slab_pool, that every branch references.
+// When the only link leads to a fusible transformer, items are handed straight to it instead.
+template <typename T>
+class output_port {
+public:
+    using output_type = T;
+
+    void attach_output(std::shared_ptr<link<T>> ch) { outputs_.push_back(std::move(ch)); }
+
+    // Downstream links in connection order, e.g. to read their link_stats
+    const std::vector<std::shared_ptr<link<T>>>& output_links() const { return outputs_; }
+
+protected:
+    void emit(T item) {
+        if (fused_) {
+            fused_->consume_fused(std::move(item));
+        } else if (outputs_.size() == 1) {
+            outputs_.front()->push(message<T>(std::move(item)));
+        } else if (outputs_.empty()) {
+            return;
+        } else if constexpr (is_envelope_v<T>) {
+            // Envelopes are already shared handles: each branch gets its own reference
+            for (std::size_t i = 0; i + 1 < outputs_.size(); ++i) {
+                outputs_[i]->push(message<T>::extra_handle(item));
+            }
+            outputs_.back()->push(message<T>(std::move(item)));
+        } else {
+            auto shared = std::allocate_shared<shared_item<T>>(pool_allocator<shared_item<T>>(), outputs_.size(),
+                                                               std::move(item), outputs_.front()->budget());
+            for (auto& ch : outputs_) ch->push(message<T>(shared));
+        }
+    }
+
+    // True if every downstream link has room for one more item
+    bool writable() const {
+        if (fused_) return fused_->writable_fused();
+        for (const auto& ch : outputs_) {
+            if (!ch->writable()) return false;
+        }
+        return true;
+    }
+
+    // Bypasses the only downstream link if it leads to a fusible stage
+    void fuse_outputs() {
+        fused_ = nullptr;
+        if (outputs_.size() != 1 || !outputs_.front()->fusible()) return;
+        auto* next = dynamic_cast<fused_input<T>*>(outputs_.front()->consumer());
+        if (next && next->fusible()) {
+            next->mark_absorbed();
+            fused_ = next;
+        }
+    }
+
+    void adopt_outputs_from(node* head) {
+        if (fused_) {
+            fused_->adopt_fused(head);
+        } else {
+            for (auto& ch : outputs_) ch->set_producer(head);
+        }
+    }
+
+    std::vector<std::shared_ptr<link<T>>> outputs_;
+    fused_input<T>* fused_ = nullptr;
+};
+
+// Upstream side of a stage: reads round-robin from every connected link
+template <typename T>
+class input_port {
+public:
+    using input_type = T;
+
+    void attach_input(std::shared_ptr<link<T>> ch) { inputs_.push_back(std::move(ch)); }
+
+    // Upstream links in connection order
+    const std::vector<std::shared_ptr<link<T>>>& input_links() const { return inputs_; }
+
+protected:
+    void place_input_links(std::size_t numa_node) {
+        for (auto& ch : inputs_) ch->bind_to_numa_node(numa_node);
+    }
+
+    bool readable() const {
+        for (const auto& ch : inputs_) {
+            if (!ch->empty()) return true;
+        }
+        return false;
+    }
+
+    bool receive(message<T>& msg) {
+        for (std::size_t i = 0; i < inputs_.size(); ++i) {
+            auto& ch = inputs_[next_input_];
+            next_input_ = (next_input_ + 1) % inputs_.size();
+            if (ch->pop(msg)) return true;
+        }
+        return false;
+    }
+
+    // Takes up to `max` items into `out` (appending); returns how many were taken
+    std::size_t receive_batch(std::vector<T>& out, std::size_t max) {
+        message<T> msg;
+        std::size_t n = 0;
+        while (n < max && receive(msg)) {
+            out.push_back(msg.take());
+            ++n;
+        }
+        return n;
+    }
+
+    // Items queued on all input links
+    std::size_t backlog() const {
+        std::size_t n = 0;
+        for (const auto& ch : inputs_) n += ch->size();
+        return n;
+    }
+
+    // Wakes upstream stages that stalled on a full link; called at the end of every step
+    void release_inputs() {
+        for (auto& ch : inputs_) ch->release_producer();
+    }
+
+    std::vector<std::shared_ptr<link<T>>> inputs_;
+    std::size_t next_input_ = 0;
+};
+
+// Produces items by calling `fn` until it returns std::nullopt or loop_count is reached.
+// `fn` may be a coroutine returning task<std::optional<T>>; the source then waits for
+// each invocation to finish without holding a worker while it is suspended.
+template <typename T>
+class source : public node, public output_port<T> {
+public:
+    using function_type = inline_function<std::optional<T>()>;
+    using coroutine_type = inline_function<task<std::optional<T>>()>;
+
+    template <typename F>
+    explicit source(F fn) {
+        if constexpr (std::is_invocable_v<F&, std::pmr::memory_resource*>) {
+            fn_ = [fn = std::move(fn)]() mutable {
+                arena_scope scope;
+                return fn(scope.resource());
+            };
+        } else if constexpr (is_task_v<std::invoke_result_t<F&>>) {
+            co_fn_ = std::move(fn);
+            coroutines_ = std::make_unique<coroutine_pool<std::optional<T>>>(*this, true, 1);
+        } else {
+            fn_ = std::move(fn);
+        }
+    }
+
+protected:
+    void start(int loop_count) override {
+        remaining_ = loop_count;
+        exhausted_ = false;
+    }
+
+    bool ready() const override {
+        if (coroutines_) {
+            return coroutines_->woken()
+                || (coroutines_->front_done() && this->writable())
+                || (coroutines_->empty() && !exhausted_ && remaining_ != 0 && this->writable()
+                    && within_budget());
+        }
+        return !exhausted_ && remaining_ != 0 && this->writable() && within_budget();
+    }
+
+    void step(std::size_t budget) override {
+        if (coroutines_) return step_coroutine(budget);
+
+        for (; budget > 0 && ready(); --budget) {
+            std::optional<T> item = fn_();
+            if (!item) {
+                exhausted_ = true;
+                break;
+            }
+            if (remaining_ > 0) --remaining_;
+            this->emit(std::move(*item));
+        }
+    }
+
+private:
+    void step_coroutine(std::size_t budget) {
+        coroutines_->resume_woken();
+        for (; budget > 0; --budget) {
+            if (coroutines_->front_done()) {
+                if (!this->writable()) break;
+                std::optional<T> item = coroutines_->take_front();
+                if (!item) {
+                    exhausted_ = true;
+                    break;
+                }
+                if (remaining_ > 0) --remaining_;
+                this->emit(std::move(*item));
+            } else if (coroutines_->empty() && !exhausted_ && remaining_ != 0 && within_budget()) {
+                coroutines_->start(co_fn_());
+            } else {
+                break;
+            }
+        }
+    }
+
+    function_type fn_;
+    coroutine_type co_fn_;
+    std::unique_ptr<coroutine_pool<std::optional<T>>> coroutines_;
+    int remaining_ = 0;
+    bool exhausted_ = true;
+};
+
+// Maps every input item to one output item.
+// A callable taking `const In&` reads fan-out items in place; one taking `In` or `In&&` gets
+// its own copy, moved in whenever this stage is the item's only consumer.
+// When a transformer is the only consumer of another transformer over a plain link,
+// engine::run fuses the two: the upstream stage calls this one directly, so the pair
+// costs no ring hand-off and no extra scheduling. Put a `bounded(...)` link between
+// them to keep a stage boundary, e.g. to spread the chain over several workers.
+// A coroutine callable returning task<Out> may keep up to max_in_flight() items
+// suspended at once; their results are still emitted in input order.
+// A callable with a trailing std::pmr::memory_resource* parameter gets a scratch arena
+// that is rewound after every call (see arena_scope); the same holds for sources and sinks.
+template <typename In, typename Out = In>
+class transformer : public node, public input_port<In>, public output_port<Out>, public fused_input<In> {
+public:
+    using function_type = inline_function<Out(In)>;
+    using reader_type = inline_function<Out(const In&)>;
+    using coroutine_type = inline_function<task<Out>(In)>;
+
+    template <typename F>
+    explicit transformer(F fn) {
+        if constexpr (std::is_invocable_v<F&, In, std::pmr::memory_resource*>) {
+            if constexpr (reads_by_ref<F, In>) {
+                reader_ = [fn = std::move(fn)](const In& item) mutable {
+                    arena_scope scope;
+                    return fn(item, scope.resource());
+                };
+            } else {
+                fn_ = [fn = std::move(fn)](In item) mutable {
+                    arena_scope scope;
+                    return fn(std::move(item), scope.resource());
+                };
+            }
+        } else if constexpr (is_task_v<std::invoke_result_t<F&, In>>) {
+            static_assert(!std::is_reference_v<callable_arg_t<F>>,
+                          "coroutine stages must take their input by value");
+            co_fn_ = std::move(fn);
+            coroutines_ = std::make_unique<coroutine_pool<Out>>(*this, true);
+        } else if constexpr (reads_by_ref<F, In>) {
+            reader_ = std::move(fn);
+        } else {
+            fn_ = std::move(fn);
+        }
+    }
+
+    // Limits how many coroutine invocations may be suspended at once
+    transformer& max_in_flight(std::size_t n) {
+        if (coroutines_) coroutines_->set_limit(n);
+        return *this;
+    }
+
+    // Runs `n` replicas of the callable concurrently; it must be safe to call from several threads.
+    // Item k goes to replica k % n and results are collected in the same rotation,
+    // so downstream stages still see input order.
+    transformer& parallel(std::size_t n, std::size_t capacity = 64) {
+        if (coroutines_) throw std::logic_error("pipef: coroutine transformers cannot run in parallel");
+        replicas_.clear();
+        if (n > 1) {
+            for (std::size_t i = 0; i < n; ++i) {
+                replicas_.push_back(std::make_unique<replica>(*this, capacity));
+            }
+        }
+        return *this;
+    }
+
+    bool fusible() const override {
+        return replicas_.empty() && !coroutines_
+            && this->inputs_.size() == 1 && this->inputs_.front()->fusible();
+    }
+
+    void mark_absorbed() override { absorbed_ = true; }
+
+    void consume_fused(In item) override {
+        this->emit(reader_ ? reader_(item) : fn_(std::move(item)));
+    }
+
+    bool writable_fused() const override { return this->writable(); }
+
+    void adopt_fused(node* head) override { this->adopt_outputs_from(head); }
+
+protected:
+    void fuse() override { this->fuse_outputs(); }
+
+    void adopt_outputs(node* head) override { this->adopt_outputs_from(head); }
+
+    void place_inputs(std::size_t numa_node) override { this->place_input_links(numa_node); }
+
+    std::vector<node*> helpers() override {
+        std::vector<node*> nodes;
+        for (auto& r : replicas_) nodes.push_back(r.get());
+        return nodes;
+    }
+
+    bool ready() const override {
+        if (coroutines_) {
+            return coroutines_->woken()
+                || (coroutines_->front_done() && this->writable())
+                || (this->readable() && !coroutines_->full());
+        }
+        if (!replicas_.empty()) {
+            return (!next_result().out.empty() && this->writable())
+                || (this->readable() && next_dispatch().in.writable());
+        }
+        return this->readable() && this->writable();
+    }
+
+    void step(std::size_t budget) override {
+        if (coroutines_) return step_coroutine(budget);
+        if (!replicas_.empty()) return step_parallel(budget);
+
+        message<In> msg;
+        for (; budget > 0 && this->writable() && this->receive(msg); --budget) {
+            this->emit(apply(msg));
+        }
+        this->release_inputs();
+    }
+
+private:
+    // One copy of the callable running as its own task, fed and drained by the owning stage
+    class replica : public node {
+    public:
+        // Results waiting in `out` count against the owner's memory budget like any other link
+        replica(transformer& owner, std::size_t capacity)
+            : node(owner.budget()), in(&owner, this, bounded(capacity)), out(this, &owner, bounded(capacity)),
+              owner_(owner) {}
+
+        channel<message<In>> in;
+        channel<Out> out;
+
+    protected:
+        bool ready() const override { return !in.empty() && out.writable(); }
+
+        void step(std::size_t budget) override {
+            message<In> msg;
+            for (; budget > 0 && out.writable() && in.pop(msg); --budget) {
+                out.push(owner_.apply(msg));
+            }
+            in.release_producer();
+        }
+
+    private:
+        transformer& owner_;
+    };
+
+    Out apply(message<In>& msg) const {
+        return reader_ ? reader_(msg.get()) : fn_(msg.take());
+    }
+
+    replica& next_result() const { return *replicas_[collected_ % replicas_.size()]; }
+    replica& next_dispatch() const { return *replicas_[dispatched_ % replicas_.size()]; }
+
+    // Emits finished results in dispatch order, then hands new items to the replicas
+    void step_parallel(std::size_t budget) {
+        Out result;
+        while (this->writable() && next_result().out.pop(result)) {
+            this->emit(std::move(result));
+            ++collected_;
+        }
+
+        message<In> msg;
+        for (; budget > 0 && next_dispatch().in.writable() && this->receive(msg); --budget) {
+            next_dispatch().in.push(std::move(msg));
+            ++dispatched_;
+        }
+
+        for (auto& r : replicas_) r->out.release_producer();
+        this->release_inputs();
+    }
+
+    // Resumes woken invocations, emits finished ones in order and starts new ones
+    void step_coroutine(std::size_t budget) {
+        coroutines_->resume_woken();
+        message<In> msg;
+        for (; budget > 0 && !coroutines_->full() && this->receive(msg); --budget) {
+            coroutines_->start(co_fn_(msg.take()));
+        }
+        while (coroutines_->front_done() && this->writable()) {
+            this->emit(coroutines_->take_front());
+        }
+        this->release_inputs();
+    }
+
+    function_type fn_;
+    reader_type reader_;
+    coroutine_type co_fn_;
+    std::unique_ptr<coroutine_pool<Out>> coroutines_;
+    std::vector<std::unique_ptr<replica>> replicas_;
+    std::size_t dispatched_ = 0;
+    std::size_t collected_ = 0;
+};
+
+// Edits every item in place and passes the same object on, e.g.
+// `mutator<std::string>([](std::string& s) { s += "\r\n"; })`; the item is moved from
+// stage to stage, so a chain of mutators never reallocates it. A transformer callable
+// taking `In&&` and returning it has the same effect.
+template <typename T>
+class mutator : public transformer<T> {
+public:
+    template <typename F>
+    explicit mutator(F fn)
+        : transformer<T>([fn = std::move(fn)](T&& item) mutable -> T {
+              fn(item);
+              return std::move(item);
+          }) {}
+};
+
+// Consumes every input item; like transformer, a `const T&` callable reads fan-out items in place.
+// A coroutine callable returning task<void> may keep up to max_in_flight() items suspended at once.
+template <typename T>
+class sink : public node, public input_port<T> {
+public:
+    using function_type = inline_function<void(T)>;
+    using reader_type = inline_function<void(const T&)>;
+    using coroutine_type = inline_function<task<void>(T)>;
+
+    template <typename F>
+    explicit sink(F fn) {
+        if constexpr (std::is_invocable_v<F&, T, std::pmr::memory_resource*>) {
+            if constexpr (reads_by_ref<F, T>) {
+                reader_ = [fn = std::move(fn)](const T& item) mutable {
+                    arena_scope scope;
+                    fn(item, scope.resource());
+                };
+            } else {
+                fn_ = [fn = std::move(fn)](T item) mutable {
+                    arena_scope scope;
+                    fn(std::move(item), scope.resource());
+                };
+            }
+        } else if constexpr (is_task_v<std::invoke_result_t<F&, T>>) {
+            static_assert(!std::is_reference_v<callable_arg_t<F>>,
+                          "coroutine stages must take their input by value");
+            co_fn_ = std::move(fn);
+            coroutines_ = std::make_unique<coroutine_pool<void>>(*this, false);
+        } else if constexpr (reads_by_ref<F, T>) {
+            reader_ = std::move(fn);
+        } else {
+            fn_ = std::move(fn);
+        }
+    }
+
+    // Limits how many coroutine invocations may be suspended at once
+    sink& max_in_flight(std::size_t n) {
+        if (coroutines_) coroutines_->set_limit(n);
+        return *this;
+    }
+
+protected:
+    void place_inputs(std::size_t numa_node) override { this->place_input_links(numa_node); }
+
+    bool ready() const override {
+        if (coroutines_) return coroutines_->woken() || (this->readable() && !coroutines_->full());
+        return this->readable();
+    }
+
+    void step(std::size_t budget) override {
+        message<T> msg;
+        if (coroutines_) {
+            coroutines_->resume_woken();
+            coroutines_->reap();
+            for (; budget > 0 && !coroutines_->full() && this->receive(msg); --budget) {
+                coroutines_->start(co_fn_(msg.take()));
+            }
+            coroutines_->reap();
+        } else {
+            for (; budget > 0 && this->receive(msg); --budget) {
+                if (reader_) {
+                    reader_(msg.get());
+                } else {
+                    fn_(msg.take());
+                }
+            }
+        }
+        this->release_inputs();
+    }
+
+private:
+    function_type fn_;
+    reader_type reader_;
+    coroutine_type co_fn_;
+    std::unique_ptr<coroutine_pool<void>> coroutines_;
+};
+
+template <typename From, typename To>
+concept linkable = std::is_base_of_v<node, From> && std::is_base_of_v<node, To>
+    && std::is_same_v<typename From::output_type, typename To::input_type>;
+
+// Connects two stages with a new link and returns the downstream stage for chaining
+template <typename From, typename To>
+    requires linkable<From, To>
+To& connect(From& from, To& to, const link_options& options = {}) {
+    using T = typename From::output_type;
+    auto ch = std::make_shared<link<T>>(&from, &to, options);
+    from.attach_output(ch);
+    to.attach_input(std::move(ch));
+    return to;
+}
+
+// Options captured between the two halves of `a | bounded(...) | b`
+template <typename From>
+struct pending_link {
+    From& from;
+    link_options options;
+};
+
+template <typename From, typename To>
+    requires linkable<From, To>
+To& operator|(From& from, To& to) {
+    return connect(from, to);
+}
+
+template <typename From, typename To>
+    requires linkable<From, To>
+To& operator|(const std::shared_ptr<From>& from, const std::shared_ptr<To>& to) {
+    return connect(*from, *to);
+}
+
+template <typename From, typename To>
+    requires linkable<From, To>
+To& operator|(From& from, const std::shared_ptr<To>& to) {
+    return connect(from, *to);
+}
+
+template <typename From>
+    requires std::is_base_of_v<node, From>
+pending_link<From> operator|(From& from, const link_options& options) {
+    return {from, options};
+}
+
+template <typename From>
+    requires std::is_base_of_v<node, From>
+pending_link<From> operator|(const std::shared_ptr<From>& from, const link_options& options) {
+    return {*from, options};
+}
+
+template <typename From, typename To>
+    requires linkable<From, To>
+To& operator|(const pending_link<From>& link, To& to) {
+    return connect(link.from, to, link.options);
+}
+
+template <typename From, typename To>
+    requires linkable<From, To>
+To& operator|(const pending_link<From>& link, const std::shared_ptr<To>& to) {
+    return connect(link.from, *to, link.options);
+}
+
+} // namespace pipef
@@ -0,0 +1,589 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bytes.h"
+#include "coroutine.h"
+#include "function.h"
+#include "reactor.h"
+#include "stage.h"
+
+namespace pipef {
+
+// A connected TCP socket, shared by the messages read from it and the stage that answers on it.
+// The descriptor is closed with the last reference, so its number cannot be reused while
+// any stage might still read from or write to it. The close goes through the watcher that last
+// waited on it, so that pending waits are cancelled first, if that is the reactor or the calling
+// thread's event loop; a descriptor never waited on, or whose loop is gone, is closed directly.
+class tcp_connection {
+public:
+    explicit tcp_connection(int fd) : fd_(fd) {}
+
+    ~tcp_connection() {
+        io_watcher* w = watcher_.load(std::memory_order_acquire);
+        if (w && (w == io_watcher::thread_override() || w == reactor::existing())) {
+            w->close(fd_);
+        } else {
+            ::close(fd_);
+        }
+    }
+
+    tcp_connection(const tcp_connection&) = delete;
+    tcp_connection& operator=(const tcp_connection&) = delete;
+
+    int fd() const { return fd_; }
+
+    // Ends the connection in both directions; pending reads see end of stream
+    void shutdown() { ::shutdown(fd_, SHUT_RDWR); }
+
+    // Records the watcher a wait on the descriptor is about to go through
+    void watched_by(io_watcher& watcher) { watcher_.store(&watcher, std::memory_order_release); }
+
+private:
+    const int fd_;
+    std::atomic<io_watcher*> watcher_{nullptr};
+};
+
+// A read-only file sent from the page cache with sendfile(), shared by every reply that carries it.
+// Its size is taken when it is opened; replies send that many bytes, or less if it shrinks.
+class file_body {
+public:
+    explicit file_body(const std::string& path) : fd_(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+        struct stat st{};
+        if (fd_ < 0 || ::fstat(fd_, &st) != 0) {
+            int err = errno;
+            if (fd_ >= 0) ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "pipef: open " + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+    }
+
+    ~file_body() { ::close(fd_); }
+
+    file_body(const file_body&) = delete;
+    file_body& operator=(const file_body&) = delete;
+
+    int fd() const { return fd_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const int fd_;
+    std::size_t size_ = 0;
+};
+
+// Bytes received on, or to be sent back to, a TCP connection.
+// An output sink sends `data` (e.g. a header block) and the shared buffers in `body` (e.g. a
+// cached body and a trailer) together with one gathering write, then `file`, if set, so a large
+// or shared body never has to be copied into `data`.
+// A reply with `keep_alive` set leaves the connection open for the next one; replies on one
+// connection are sent in the order they reach the sink.
+struct tcp_message {
+    std::shared_ptr<tcp_connection> connection;
+    std::string data;
+    std::vector<bytes> body = {};
+    std::shared_ptr<const file_body> file = nullptr;
+    bool keep_alive = false;
+};
+
+// Position in the buffers of a reply, `data` then each of `body`, as they are sent
+class gather_cursor {
+public:
+    explicit gather_cursor(const tcp_message& msg) : msg_(&msg) { skip_empty(); }
+
+    bool done() const { return index_ > msg_->body.size(); }
+
+    // Describes up to `max` of the buffers left, from the current position; returns how many
+    int fill(iovec* iov, int max) const {
+        int n = 0;
+        for (std::size_t i = index_; i <= msg_->body.size() && n < max; ++i) {
+            std::string_view p = part(i).substr(i == index_ ? offset_ : 0);
+            if (p.empty()) continue;
+            iov[n].iov_base = const_cast<char*>(p.data());
+            iov[n].iov_len = p.size();
+            ++n;
+        }
+        return n;
+    }
+
+    // Moves past `n` bytes that were sent
+    void advance(std::size_t n) {
+        offset_ += n;
+        skip_empty();
+    }
+
+private:
+    std::string_view part(std::size_t i) const { return i == 0 ? std::string_view(msg_->data) : msg_->body[i - 1].view(); }
+
+    void skip_empty() {
+        while (!done() && offset_ >= part(index_).size()) {
+            offset_ -= part(index_).size();
+            ++index_;
+        }
+    }
+
+    const tcp_message* msg_;
+    std::size_t index_ = 0;
+    std::size_t offset_ = 0;
+};
+
+// Sends [offset, size) of a file on a non-blocking socket until it would block;
+// returns false on EAGAIN, true once the file is sent or the connection failed.
+// sendfile() has no MSG_NOSIGNAL, so SIGPIPE is blocked meanwhile and one it raised is discarded.
+inline bool send_file(int fd, const file_body& file, off_t& offset) {
+    sigset_t pipe, previous;
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, &previous);
+
+    bool done = true;
+    while (static_cast<std::size_t>(offset) < file.size()) {
+        ssize_t n = ::sendfile(fd, file.fd(), &offset, file.size() - static_cast<std::size_t>(offset));
+        if (n > 0 || (n < 0 && errno == EINTR)) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            done = false;
+        } else if (n < 0 && errno == EPIPE && !sigismember(&previous, SIGPIPE)) {
+            timespec no_wait{};
+            sigtimedwait(&pipe, nullptr, &no_wait);
+        }
+        break; // would block, the peer went away, or the file shrank
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return done;
+}
+
+// Length of the first message in the bytes buffered from a connection, or 0 while it is
+// incomplete; lets a source emit one item per request however the stream was split into reads.
+// It must not return more than it was given.
+using tcp_framer = inline_function<std::size_t(std::string_view)>;
+
+// Bytes read from a connection and not yet emitted, cut into messages by a tcp_framer
+class tcp_reassembly {
+public:
+    bool empty() const { return offset_ == buffer_.size(); }
+
+    void append(const char* data, std::size_t size) {
+        if (offset_ > 0 && offset_ == buffer_.size()) {
+            buffer_.clear();
+            offset_ = 0;
+        }
+        buffer_.append(data, size);
+    }
+
+    // Moves the next complete message into `out`: everything buffered if there is no framer.
+    // A message that is all of the buffer is moved out without a copy.
+    bool next(const tcp_framer& framer, std::string& out) {
+        if (empty()) return false;
+        std::string_view rest = std::string_view(buffer_).substr(offset_);
+        std::size_t size = framer ? std::min(framer(rest), rest.size()) : rest.size();
+        if (size == 0) return false;
+        if (offset_ == 0 && size == buffer_.size()) {
+            out = std::move(buffer_);
+            buffer_.clear();
+        } else {
+            out.assign(rest.substr(0, size));
+            offset_ += size;
+            if (offset_ == buffer_.size() || offset_ > buffer_.size() / 2) {
+                buffer_.erase(0, offset_);
+                offset_ = 0;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::string buffer_;
+    std::size_t offset_ = 0;
+};
+
+template <>
+struct payload_size<tcp_message> {
+    std::size_t operator()(const tcp_message& m) const { return sizeof(m) + m.data.capacity(); }
+};
+
+// A spilled tcp_message keeps its connection (and shared buffers) alive through a pointer to a
+// heap copy of the references
+template <>
+struct spill_codec<tcp_message> {
+    struct references {
+        std::shared_ptr<tcp_connection> connection;
+        std::vector<bytes> body;
+        std::shared_ptr<const file_body> file;
+        bool keep_alive;
+    };
+
+    static void encode(tcp_message&& m, std::string& out) {
+        auto* refs = new references{std::move(m.connection), std::move(m.body), std::move(m.file), m.keep_alive};
+        out.append(reinterpret_cast<const char*>(&refs), sizeof(refs));
+        out.append(m.data);
+    }
+    static tcp_message decode(std::string_view in) {
+        references* refs;
+        std::memcpy(&refs, in.data(), sizeof(refs));
+        tcp_message m{std::move(refs->connection), std::string(in.substr(sizeof(refs))), std::move(refs->body),
+                      std::move(refs->file), refs->keep_alive};
+        delete refs;
+        return m;
+    }
+};
+
+// Opens a non-blocking listening socket on `port` (any free port if 0)
+inline int listen_tcp(unsigned short port, int backlog) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "bind");
+    }
+    if (::listen(fd, backlog) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "listen");
+    }
+    return fd;
+}
+
+// Port a socket is bound to
+inline unsigned short local_port(int fd) {
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    return ntohs(addr.sin_port);
+}
+
+// Accepts connections on a port and emits whatever each client sends as tcp_message items:
+// each read as it comes, or one item per message with framed(), e.g. for pipelined requests.
+// The listening socket and every connection are readiness-driven: the stage is only
+// scheduled when the reactor (or an external event loop) reports a descriptor ready.
+// A connection stays open until the client closes it, a reply without keep_alive is sent, or
+// it has been idle for idle_timeout().
+// Connect it through `spilled(...)` to keep reading while a downstream stage falls behind.
+class tcp_input_source : public node, public output_port<tcp_message> {
+public:
+    static constexpr std::size_t read_size = 64 * 1024;
+    static constexpr std::chrono::milliseconds default_idle_timeout{60000};
+
+    explicit tcp_input_source(unsigned short port, int backlog = SOMAXCONN) : buffer_(read_size) {
+        listener_.conn = std::make_shared<tcp_connection>(listen_tcp(port, backlog));
+        listener_.owner = this;
+    }
+
+    ~tcp_input_source() override {
+        // Runs cancel the watches they leave parked; drop any armed outside of one
+        disarm(listener_);
+        if (timer_.conn) disarm(timer_);
+        for (auto& [w, owned] : connections_) disarm(*w);
+    }
+
+    // Port actually bound, e.g. when constructed with port 0
+    unsigned short port() const { return local_port(listener_.conn->fd()); }
+
+    // Cuts what each connection sends into messages, see tcp_framer; call before running
+    tcp_input_source& framed(tcp_framer framer) {
+        framer_ = std::move(framer);
+        return *this;
+    }
+
+    // Closes a connection once it has sent no complete message for `timeout` (up to half as long
+    // again) while none of its requests or replies were in flight, e.g. a keep-alive client that
+    // went quiet or one trickling in a request. 0 keeps idle connections open; call before running
+    tcp_input_source& idle_timeout(std::chrono::milliseconds timeout) {
+        idle_timeout_ = timeout;
+        return *this;
+    }
+
+protected:
+    void start(int loop_count) override {
+        remaining_ = loop_count;
+        // Watches are armed from step() so they go to the watcher of the thread running the stage
+        if (!listening_ && remaining_ != 0) {
+            carried_.push_back(&listener_);
+            if (idle_timeout_.count() > 0) start_timer();
+        }
+    }
+
+    bool ready() const override {
+        return (!carried_.empty() || ready_count_.load(std::memory_order_acquire) > 0) && writable();
+    }
+
+    void step(std::size_t budget) override {
+        std::vector<watch*> work = std::exchange(carried_, {});
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            work.insert(work.end(), ready_.begin(), ready_.end());
+            ready_count_.fetch_sub(ready_.size(), std::memory_order_relaxed);
+            ready_.clear();
+        }
+
+        for (watch* w : work) {
+            if (remaining_ == 0) break;
+            if (w == &listener_) {
+                accept_all();
+            } else if (w == &timer_) {
+                expire_idle();
+            } else if (!read_from(*w, budget)) {
+                carried_.push_back(w);
+            }
+        }
+        if (remaining_ == 0) shut_down();
+    }
+
+private:
+    struct watch : io_handler {
+        tcp_input_source* owner = nullptr;
+        std::shared_ptr<tcp_connection> conn;
+        tcp_reassembly received;
+        unsigned idle_ticks = 0; // idle timer ticks since the last message
+        std::atomic<io_watcher*> watcher{nullptr}; // while armed
+        void on_ready(std::uint32_t) override {
+            watcher.store(nullptr, std::memory_order_release);
+            owner->mark_ready(this);
+        }
+    };
+
+    void mark_ready(watch* w) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_.push_back(w);
+        }
+        ready_count_.fetch_add(1, std::memory_order_release);
+        notify();
+        release();
+    }
+
+    void arm(watch& w) {
+        hold();
+        io_watcher& watcher = io_watcher::current();
+        w.watcher.store(&watcher, std::memory_order_release);
+        w.conn->watched_by(watcher);
+        try {
+            watcher.watch(w.conn->fd(), EPOLLIN, &w);
+        } catch (...) {
+            w.watcher.store(nullptr, std::memory_order_relaxed);
+            release();
+            throw;
+        }
+    }
+
+    static void disarm(watch& w) {
+        if (io_watcher* watcher = w.watcher.exchange(nullptr, std::memory_order_acq_rel)) {
+            watcher->unwatch(w.conn->fd(), &w);
+        }
+    }
+
+    // Takes back a watch during a run; false if it fired first and is queued in ready_
+    bool take_back(watch& w) {
+        io_watcher* watcher = w.watcher.load(std::memory_order_acquire);
+        if (!watcher) return false;
+        watcher->unwatch(w.conn->fd(), &w);
+        if (!w.watcher.exchange(nullptr, std::memory_order_acq_rel)) return false;
+        release();
+        return true;
+    }
+
+    // Ticks every half idle timeout; the tick is watched like a connection and armed from step()
+    void start_timer() {
+        if (!timer_.conn) {
+            int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (fd < 0) throw std::system_error(errno, std::generic_category(), "timerfd_create");
+            timer_.owner = this;
+            timer_.conn = std::make_shared<tcp_connection>(fd);
+        }
+        auto tick = std::max(std::chrono::nanoseconds(idle_timeout_) / 2, std::chrono::nanoseconds(1000000));
+        itimerspec spec{};
+        spec.it_interval.tv_sec = static_cast<time_t>(tick.count() / 1000000000);
+        spec.it_interval.tv_nsec = static_cast<long>(tick.count() % 1000000000);
+        spec.it_value = spec.it_interval;
+        ::timerfd_settime(timer_.conn->fd(), 0, &spec, nullptr);
+        carried_.push_back(&timer_);
+    }
+
+    // Closes connections that have been idle for two whole ticks; ones with a request or reply
+    // still holding the connection, or with data being read, are not idle.
+    // Also runs when the timer is first armed, or queued twice from the last run; those are no ticks.
+    void expire_idle() {
+        std::uint64_t ticks = 0;
+        for (std::uint64_t n; ::read(timer_.conn->fd(), &n, sizeof(n)) == sizeof(n);) ticks += n;
+        for (auto it = connections_.begin(); ticks > 0 && it != connections_.end();) {
+            watch& w = *it->first;
+            if (w.conn.use_count() > 1) w.idle_ticks = 0;
+            if (++w.idle_ticks > 2 && take_back(w)) {
+                it = connections_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (!timer_.watcher.load(std::memory_order_acquire)) arm(timer_);
+    }
+
+    void accept_all() {
+        listening_ = true;
+        for (;;) {
+            int fd = ::accept4(listener_.conn->fd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) break;
+            auto w = std::make_unique<watch>();
+            w->owner = this;
+            w->conn = std::make_shared<tcp_connection>(fd);
+            watch& ref = *w;
+            connections_.emplace(&ref, std::move(w));
+            arm(ref);
+        }
+        arm(listener_);
+    }
+
+    // Reads until the socket would block; returns false if it stopped because the output is full
+    bool read_from(watch& w, std::size_t& budget) {
+        std::string data;
+        for (;;) {
+            // Messages left over from an earlier read go first
+            for (; budget > 0 && writable() && w.received.next(framer_, data); --budget) {
+                emit(tcp_message{w.conn, std::move(data)});
+                w.idle_ticks = 0;
+                if (remaining_ > 0 && --remaining_ == 0) return true;
+            }
+            if (budget == 0 || !writable()) return false;
+            ssize_t n = ::read(w.conn->fd(), buffer_.data(), buffer_.size());
+            if (n > 0) {
+                w.received.append(buffer_.data(), static_cast<std::size_t>(n));
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                arm(w);
+                return true;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                // Peer finished sending, or the connection was shut down; replies in flight keep it alive
+                drop(w);
+                return true;
+            }
+        }
+    }
+
+    void drop(watch& w) { connections_.erase(&w); }
+
+    // loop_count reached: stop accepting and cancel pending watches so the run can finish
+    void shut_down() {
+        if (!listening_) return;
+        listening_ = false;
+        io_watcher::current().cancel(listener_.conn->fd());
+        if (timer_.conn) io_watcher::current().cancel(timer_.conn->fd());
+        for (auto& [w, owned] : connections_) io_watcher::current().cancel(w->conn->fd());
+    }
+
+    watch listener_;
+    watch timer_;
+    std::chrono::milliseconds idle_timeout_ = default_idle_timeout;
+    tcp_framer framer_;
+    std::unordered_map<watch*, std::unique_ptr<watch>> connections_;
+    std::vector<watch*> carried_;
+    std::vector<char> buffer_;
+    int remaining_ = 0;
+    bool listening_ = false;
+
+    std::mutex mutex_;
+    std::vector<watch*> ready_;
+    std::atomic<std::size_t> ready_count_{0};
+};
+
+// Writes each message back to its connection: data and body go out with sendmsg() gathering
+// all of their buffers, the file with sendfile(). The connection is shut down after a reply
+// without keep_alive, or when a write fails; replies queued behind it on that connection are dropped.
+// Writes are coroutines, so a slow client parks its reply instead of blocking a worker; a reply
+// arriving while an earlier one on the same connection is parked is sent right after it.
+class tcp_output_sink : public sink<tcp_message> {
+public:
+    // Buffers passed to one sendmsg(); more are sent with further calls
+    static constexpr int max_iov = 16;
+
+    tcp_output_sink() : sink<tcp_message>([this](tcp_message msg) { return send(std::move(msg)); }) {}
+
+private:
+    task<void> send(tcp_message msg) {
+        std::shared_ptr<tcp_connection> conn = msg.connection;
+        auto [it, idle] = queued_.try_emplace(conn.get());
+        if (!idle) {
+            it->second.push_back(std::move(msg));
+            co_return;
+        }
+
+        int fd = conn->fd();
+        bool open = true;
+        std::vector<tcp_message> batch; // replies that queued up behind the one being sent
+        std::size_t next = 0;
+        for (tcp_message* m = &msg; m && open;) {
+            gather_cursor cursor(*m);
+            while (open && !cursor.done()) {
+                iovec iov[max_iov];
+                msghdr hdr{};
+                hdr.msg_iov = iov;
+                hdr.msg_iovlen = static_cast<std::size_t>(cursor.fill(iov, max_iov));
+                // The file follows at once, so let the kernel fill the last segment from it
+                ssize_t n = ::sendmsg(fd, &hdr, MSG_NOSIGNAL | (m->file ? MSG_MORE : 0));
+                if (n > 0) {
+                    cursor.advance(static_cast<std::size_t>(n));
+                } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    conn->watched_by(io_watcher::current());
+                    co_await wait_writable(fd);
+                } else if (n < 0 && errno == EINTR) {
+                    continue;
+                } else {
+                    open = false;
+                }
+            }
+            if (open && m->file) {
+                off_t offset = 0;
+                while (!send_file(fd, *m->file, offset)) {
+                    conn->watched_by(io_watcher::current());
+                    co_await wait_writable(fd);
+                }
+                open = static_cast<std::size_t>(offset) == m->file->size();
+            }
+            open = open && m->keep_alive;
+
+            if (next == batch.size()) {
+                batch = std::exchange(queued_[conn.get()], {});
+                next = 0;
+            }
+            m = next < batch.size() ? &batch[next++] : nullptr;
+        }
+        if (!open) conn->shutdown();
+        queued_.erase(conn.get());
+    }
+
+    // Connections with a reply being sent, and the replies waiting for it
+    std::unordered_map<tcp_connection*, std::vector<tcp_message>> queued_;
+};
+
+} // namespace pipef
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pipef {
+
+// NUMA layout of the machine, read from sysfs.
+// Placement goes through pthread_setaffinity_np and the mbind system call directly,
+// so using it needs neither libnuma nor extra link flags.
+class numa_topology {
+public:
+    static const numa_topology& system() {
+        static const numa_topology topology("/sys/devices/system/node");
+        return topology;
+    }
+
+    // Reads the node directories (node0/cpulist, ...) below `sysfs_nodes`
+    explicit numa_topology(const std::string& sysfs_nodes) {
+        for (std::size_t id = 0; id < 1024; ++id) {
+            std::ifstream list(sysfs_nodes + "/node" + std::to_string(id) + "/cpulist");
+            if (!list) continue;
+            std::string text;
+            std::getline(list, text);
+            auto cpus = parse_cpu_list(text);
+            if (cpus.empty()) continue; // memory-only node
+            ids_.push_back(id);
+            cpus_.push_back(std::move(cpus));
+        }
+        if (cpus_.empty()) {
+            ids_.push_back(0);
+            cpus_.emplace_back();
+            unsigned n = std::thread::hardware_concurrency();
+            for (unsigned cpu = 0; cpu < (n == 0 ? 1 : n); ++cpu) cpus_.back().push_back(static_cast<int>(cpu));
+        }
+    }
+
+    // Number of NUMA nodes; 1 on machines (or containers) without NUMA information
+    std::size_t nodes() const { return cpus_.size(); }
+
+    // CPUs belonging to `node`
+    const std::vector<int>& cpus(std::size_t node) const { return cpus_[node % cpus_.size()]; }
+
+    // Restricts the calling thread to the CPUs of `node`
+    bool bind_thread(std::size_t node) const {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus(node)) CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return false;
+        thread_node() = node % cpus_.size();
+        return true;
+    }
+
+    // Node the calling thread was last bound to with bind_thread; 0 if it never was
+    static std::size_t current_node() { return thread_node(); }
+
+    // Forgets the calling thread's node once it has its original affinity back
+    static void unbind_thread() { thread_node() = 0; }
+
+    // Moves the whole pages inside [p, p + length) to `node`, and keeps them there
+    bool bind_memory(void* p, std::size_t length, std::size_t node) const {
+        if (nodes() < 2) return false;
+        auto page = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+        auto begin = (reinterpret_cast<std::uintptr_t>(p) + page - 1) & ~(page - 1);
+        auto end = (reinterpret_cast<std::uintptr_t>(p) + length) & ~(page - 1);
+        if (begin >= end) return false;
+
+        unsigned long mask[16] = {};
+        std::size_t id = ids_[node % ids_.size()];
+        if (id >= sizeof(mask) * 8) return false;
+        mask[id / (sizeof(unsigned long) * 8)] |= 1ul << (id % (sizeof(unsigned long) * 8));
+        return ::syscall(SYS_mbind, begin, end - begin, MPOL_BIND, mask, sizeof(mask) * 8, MPOL_MF_MOVE) == 0;
+    }
+
+private:
+    static std::size_t& thread_node() {
+        thread_local std::size_t node = 0;
+        return node;
+    }
+
+    // Parses lists such as "0-3,8-11"
+    static std::vector<int> parse_cpu_list(const std::string& text) {
+        std::vector<int> cpus;
+        std::stringstream ranges(text);
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            if (range.empty()) continue;
+            auto dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    std::vector<std::size_t> ids_;
+    std::vector<std::vector<int>> cpus_;
+};
+
+} // namespace pipef
@@ -0,0 +1,729 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "reactor.h"
+#include "scheduler.h"
+#include "stage.h"
+#include "tcp.h"
+
+namespace pipef {
+
+// Receives the completions of a request queued on a uring_driver
+class uring_operation {
+public:
+    virtual ~uring_operation() = default;
+
+    // Called for every CQE of the request; the last one comes without IORING_CQE_F_MORE
+    virtual void complete(int res, std::uint32_t flags) = 0;
+};
+
+// Runs an engine on an io_uring instance: `engine->run_on(driver, loop_count, duration_ms)`.
+// Like uv_driver, every stage runs on the calling thread. Requests queued by stages
+// (see prepare) and descriptor waits are submitted together, and the loop submits and
+// sleeps in a single io_uring_enter once no task is left, so a request/response cycle
+// on the uring_tcp stages costs one system call. The driver also owns a ring of
+// provided receive buffers, selected by the kernel as data arrives.
+// Needs Linux 6.0 or later; talks to the kernel directly, so no liburing is required.
+// Not included by pipef.h.
+class uring_driver : public io_watcher {
+public:
+    explicit uring_driver(unsigned entries = 1024, unsigned buffer_count = 256,
+                          std::size_t buffer_size = 16 * 1024)
+        : buffer_count_(static_cast<unsigned>(round_up_pow2(buffer_count))), buffer_size_(buffer_size) {
+        try {
+            setup(entries);
+            setup_buffers();
+            wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+            if (wake_fd_ < 0) throw std::system_error(errno, std::generic_category(), "eventfd");
+        } catch (...) {
+            teardown();
+            throw;
+        }
+        wake_.driver = this;
+    }
+
+    ~uring_driver() override { teardown(); }
+
+    uring_driver(const uring_driver&) = delete;
+    uring_driver& operator=(const uring_driver&) = delete;
+
+    // The driver running stages on the calling thread, if any
+    static uring_driver* current() { return dynamic_cast<uring_driver*>(thread_override()); }
+
+    static uring_driver& require() {
+        uring_driver* d = current();
+        if (!d) throw std::logic_error("pipef: io_uring stages must run on a uring_driver (engine::run_on)");
+        return *d;
+    }
+
+    // Queues a request whose completions go to `op` (none if null); it is submitted with
+    // the loop's next io_uring_enter. Loop thread only, like everything below.
+    io_uring_sqe& prepare(std::uint8_t opcode, int fd, uring_operation* op) {
+        if (sq_tail_ - std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire) >= sq_entries_) {
+            enter(false);
+        }
+        io_uring_sqe& sqe = sqes_[sq_tail_ & sq_mask_];
+        ++sq_tail_;
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.user_data = reinterpret_cast<std::uint64_t>(op);
+        if (op) {
+            ++in_flight_;
+            ++requests_;
+        }
+        return sqe;
+    }
+
+    // Asks the kernel to cancel the requests of `op`; they complete with -ECANCELED
+    void cancel(uring_operation* op) {
+        io_uring_sqe& sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, nullptr);
+        sqe.addr = reinterpret_cast<std::uint64_t>(op);
+        sqe.cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    }
+
+    // Provided buffers: pass IOSQE_BUFFER_SELECT and buffer_group() to a receive; its CQEs then
+    // carry IORING_CQE_F_BUFFER and the buffer id, whose data stays valid until recycle_buffer(id)
+    static constexpr std::uint16_t buffer_group() { return 0; }
+    const char* buffer(std::uint16_t id) const { return buffers_.get() + std::size_t{id} * buffer_size_; }
+
+    void recycle_buffer(std::uint16_t id) {
+        // Not buffer_ring_->bufs: in C++ the header's flexible-array wrapper moves it to offset 8
+        io_uring_buf& b = reinterpret_cast<io_uring_buf*>(buffer_ring_)[buffer_tail_ & (buffer_count_ - 1)];
+        b.addr = reinterpret_cast<std::uint64_t>(buffer(id));
+        b.len = static_cast<std::uint32_t>(buffer_size_);
+        b.bid = id;
+        ++buffer_tail_;
+        std::atomic_ref<std::uint16_t>(buffer_ring_->tail).store(buffer_tail_, std::memory_order_release);
+    }
+
+    // io_watcher, for readiness-based stages: one-shot polls
+    void watch(int fd, std::uint32_t events, io_handler* h) override {
+        auto* op = new poll_op(this, fd, h);
+        polls_.emplace(fd, op);
+        io_uring_sqe& sqe = prepare(IORING_OP_POLL_ADD, fd, op);
+        sqe.poll32_events = (events & EPOLLIN) ? EPOLLIN | EPOLLRDHUP : EPOLLOUT;
+    }
+
+    void cancel(int fd) override {
+        auto [first, last] = polls_.equal_range(fd);
+        std::vector<io_handler*> handlers;
+        for (auto it = first; it != last; ++it) {
+            io_uring_sqe& sqe = prepare(IORING_OP_POLL_REMOVE, -1, nullptr);
+            sqe.addr = reinterpret_cast<std::uint64_t>(it->second);
+            handlers.push_back(std::exchange(it->second->handler, nullptr));
+        }
+        polls_.erase(first, last);
+        for (io_handler* h : handlers) h->on_ready(EPOLLHUP);
+    }
+
+    void unwatch(int fd, io_handler* h) override {
+        auto [first, last] = polls_.equal_range(fd);
+        for (auto it = first; it != last;) {
+            if (it->second->handler != h) {
+                ++it;
+                continue;
+            }
+            io_uring_sqe& sqe = prepare(IORING_OP_POLL_REMOVE, -1, nullptr);
+            sqe.addr = reinterpret_cast<std::uint64_t>(it->second);
+            it->second->handler = nullptr;
+            it = polls_.erase(it);
+        }
+    }
+
+    // Queued like any other request, after the requests already using `fd`
+    void close(int fd) override {
+        cancel(fd);
+        prepare(IORING_OP_CLOSE, fd, nullptr);
+    }
+
+    // Called by engine::run_on between scheduler begin() and finish()
+    void drive(scheduler& sched) {
+        io_watcher* outer = std::exchange(thread_override(), this);
+        loop_thread_ = std::this_thread::get_id();
+        driving_ = true;
+
+        arm_wake();
+        sched.set_waker([this] {
+            if (std::this_thread::get_id() == loop_thread_) return; // the loop polls right after
+            std::uint64_t one = 1;
+            [[maybe_unused]] auto n = ::write(wake_fd_, &one, sizeof(one));
+        });
+        if (sched.deadline() != std::chrono::steady_clock::time_point::max()) {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                sched.deadline() - std::chrono::steady_clock::now());
+            left = std::max(left, std::chrono::nanoseconds(0));
+            timer_.ts.tv_sec = left.count() / 1000000000;
+            timer_.ts.tv_nsec = left.count() % 1000000000;
+            io_uring_sqe& sqe = prepare(IORING_OP_TIMEOUT, -1, &timer_);
+            sqe.addr = reinterpret_cast<std::uint64_t>(&timer_.ts);
+            sqe.len = 1;
+        }
+
+        try {
+            for (;;) {
+                reap();
+                std::size_t ran = sched.poll(scheduler::task_budget);
+                if (sched.finished()) break;
+                // With no task left, submit what the tasks queued and sleep in the same call
+                enter(ran < scheduler::task_budget && cq_empty());
+            }
+        } catch (...) {
+            stop(sched, outer);
+            throw;
+        }
+        stop(sched, outer);
+    }
+
+private:
+    struct poll_op : uring_operation {
+        poll_op(uring_driver* d, int fd, io_handler* h) : driver(d), fd(fd), handler(h) {}
+        void complete(int res, std::uint32_t) override { driver->polled(this, res); }
+
+        uring_driver* driver;
+        int fd;
+        io_handler* handler;
+    };
+
+    struct wake_op : uring_operation {
+        void complete(int res, std::uint32_t) override {
+            if (res != -ECANCELED && driver->driving_) driver->arm_wake();
+        }
+
+        uring_driver* driver = nullptr;
+        std::uint64_t counter = 0;
+    };
+
+    struct timer_op : uring_operation {
+        void complete(int, std::uint32_t) override {} // the loop sees the deadline has passed
+
+        __kernel_timespec ts{};
+    };
+
+    void setup(unsigned entries) {
+        io_uring_params p{};
+        p.flags = IORING_SETUP_CLAMP | IORING_SETUP_COOP_TASKRUN;
+        ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if (ring_fd_ < 0 && errno == EINVAL) {
+            p = {};
+            p.flags = IORING_SETUP_CLAMP;
+            ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        }
+        if (ring_fd_ < 0) throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+
+        sq_map_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_map_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+
+        sq_map_ = map(sq_map_size_, IORING_OFF_SQ_RING);
+        cq_map_ = single ? sq_map_ : map(cq_map_size_, IORING_OFF_CQ_RING);
+        sqes_map_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map(sqes_map_size_, IORING_OFF_SQES));
+
+        auto* sq = static_cast<char*>(sq_map_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_ktail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        auto* array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        for (unsigned i = 0; i < sq_entries_; ++i) array[i] = i;
+        sq_tail_ = submitted_ = *sq_ktail_;
+
+        auto* cq = static_cast<char*>(cq_map_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    }
+
+    void* map(std::size_t size, std::uint64_t offset) {
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                         static_cast<off_t>(offset));
+        if (p == MAP_FAILED) throw std::system_error(errno, std::generic_category(), "io_uring mmap");
+        return p;
+    }
+
+    void setup_buffers() {
+        if (buffer_count_ > 32768) throw std::invalid_argument("pipef: at most 32768 io_uring buffers");
+        buffers_.reset(new char[std::size_t{buffer_count_} * buffer_size_]);
+        buffer_ring_size_ = buffer_count_ * sizeof(io_uring_buf);
+        void* ring = ::mmap(nullptr, buffer_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) throw std::system_error(errno, std::generic_category(), "io_uring buffers");
+        buffer_ring_ = static_cast<io_uring_buf_ring*>(ring);
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<std::uint64_t>(buffer_ring_);
+        reg.ring_entries = buffer_count_;
+        reg.bgid = buffer_group();
+        if (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+            throw std::system_error(errno, std::generic_category(), "io_uring provided buffers");
+        }
+        for (unsigned id = 0; id < buffer_count_; ++id) recycle_buffer(static_cast<std::uint16_t>(id));
+    }
+
+    void teardown() {
+        for (auto& [fd, op] : polls_) delete op;
+        polls_.clear();
+        if (wake_fd_ >= 0) ::close(wake_fd_);
+        if (ring_fd_ >= 0) ::close(ring_fd_); // also unregisters the buffers
+        if (buffer_ring_) ::munmap(buffer_ring_, buffer_ring_size_);
+        if (sqes_) ::munmap(sqes_, sqes_map_size_);
+        if (cq_map_ && cq_map_ != sq_map_) ::munmap(cq_map_, cq_map_size_);
+        if (sq_map_) ::munmap(sq_map_, sq_map_size_);
+        wake_fd_ = ring_fd_ = -1;
+        buffer_ring_ = nullptr;
+        sqes_ = nullptr;
+        sq_map_ = cq_map_ = nullptr;
+    }
+
+    void arm_wake() {
+        io_uring_sqe& sqe = prepare(IORING_OP_READ, wake_fd_, &wake_);
+        sqe.addr = reinterpret_cast<std::uint64_t>(&wake_.counter);
+        sqe.len = sizeof(wake_.counter);
+    }
+
+    bool cq_empty() const {
+        return std::atomic_ref<unsigned>(*cq_head_).load(std::memory_order_relaxed)
+            == std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+    }
+
+    // Submits queued requests and, if `wait`, sleeps until a completion arrives
+    void enter(bool wait) {
+        unsigned to_submit = sq_tail_ - submitted_;
+        if (to_submit == 0 && !wait) return;
+        std::atomic_ref<unsigned>(*sq_ktail_).store(sq_tail_, std::memory_order_release);
+        for (;;) {
+            long n = ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait ? 1u : 0u,
+                               wait ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) return; // reaped and retried by the loop
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+            submitted_ += static_cast<unsigned>(n);
+            to_submit -= static_cast<unsigned>(n);
+            if (to_submit == 0 || n == 0) return;
+            wait = false;
+        }
+    }
+
+    void reap() {
+        std::atomic_ref<unsigned> head_ref(*cq_head_);
+        std::atomic_ref<unsigned> tail_ref(*cq_tail_);
+        unsigned head = head_ref.load(std::memory_order_relaxed);
+        while (head != tail_ref.load(std::memory_order_acquire)) {
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            head_ref.store(++head, std::memory_order_release);
+            auto* op = reinterpret_cast<uring_operation*>(cqe.user_data);
+            if (!op) continue;
+            if (!(cqe.flags & IORING_CQE_F_MORE)) --in_flight_;
+            op->complete(cqe.res, cqe.flags);
+        }
+    }
+
+    void polled(poll_op* op, int res) {
+        std::unique_ptr<poll_op> owned(op);
+        if (!op->handler) return; // cancelled; the handler has been told already
+        auto [first, last] = polls_.equal_range(op->fd);
+        for (auto it = first; it != last; ++it) {
+            if (it->second == op) {
+                polls_.erase(it);
+                break;
+            }
+        }
+        op->handler->on_ready(res >= 0 ? static_cast<std::uint32_t>(res) : static_cast<std::uint32_t>(EPOLLERR));
+    }
+
+    // Parked watches are woken as cancelled, and every other request is cancelled and
+    // reaped, so nothing in flight outlives the run or refers to a stage after it
+    void stop(scheduler& sched, io_watcher* outer) {
+        sched.set_waker({});
+        driving_ = false;
+        while (!polls_.empty()) cancel(polls_.begin()->first);
+        std::uint64_t cancelled_at = ~std::uint64_t{0};
+        while (in_flight_ > 0) {
+            if (requests_ != cancelled_at) {
+                io_uring_sqe& sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, nullptr);
+                sqe.cancel_flags = IORING_ASYNC_CANCEL_ANY;
+                cancelled_at = requests_;
+            }
+            enter(cq_empty());
+            reap();
+        }
+        enter(false); // e.g. closes queued by completions
+        thread_override() = outer;
+    }
+
+    const unsigned buffer_count_;
+    const std::size_t buffer_size_;
+
+    int ring_fd_ = -1;
+    int wake_fd_ = -1;
+    void* sq_map_ = nullptr;
+    void* cq_map_ = nullptr;
+    std::size_t sq_map_size_ = 0;
+    std::size_t cq_map_size_ = 0;
+    std::size_t sqes_map_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_ktail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_tail_ = 0;   // local tail, published on enter
+    unsigned submitted_ = 0; // tail the kernel has consumed up to
+    io_uring_sqe* sqes_ = nullptr;
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    std::unique_ptr<char[]> buffers_;
+    io_uring_buf_ring* buffer_ring_ = nullptr;
+    std::size_t buffer_ring_size_ = 0;
+    std::uint16_t buffer_tail_ = 0;
+
+    std::size_t in_flight_ = 0;   // requests with an operation still to see their last CQE
+    std::uint64_t requests_ = 0;  // requests with an operation ever queued
+    bool driving_ = false;
+    std::thread::id loop_thread_;
+    wake_op wake_;
+    timer_op timer_;
+    std::unordered_multimap<int, poll_op*> polls_;
+};
+
+// io_uring counterpart of tcp_input_source, for engines run on a uring_driver.
+// The listening socket gets one multishot accept and every connection one multishot
+// receive into the driver's provided buffers, so data arrives without a system call
+// per read. When `max_backlog` received messages wait for room downstream, receives
+// are paused until half of them have been emitted. Like tcp_input_source, it can cut the
+// stream into messages with framed().
+class uring_tcp_input_source : public node, public output_port<tcp_message> {
+public:
+    explicit uring_tcp_input_source(unsigned short port, int backlog = SOMAXCONN, std::size_t max_backlog = 1024)
+        : listener_(std::make_shared<tcp_connection>(listen_tcp(port, backlog))), max_backlog_(max_backlog) {
+        acceptor_.owner = this;
+    }
+
+    // Port actually bound, e.g. when constructed with port 0
+    unsigned short port() const { return local_port(listener_->fd()); }
+
+    // Cuts what each connection sends into messages, see tcp_framer; call before running
+    uring_tcp_input_source& framed(tcp_framer framer) {
+        framer_ = std::move(framer);
+        return *this;
+    }
+
+protected:
+    void start(int loop_count) override { remaining_ = loop_count; }
+
+    bool ready() const override {
+        return (!received_.empty() && writable())
+            || (remaining_ != 0 && !accepting_)
+            || (remaining_ != 0 && !paused_.empty() && received_.size() <= max_backlog_ / 2);
+    }
+
+    void step(std::size_t budget) override {
+        uring_driver& driver = uring_driver::require();
+        driver_ = &driver;
+        if (remaining_ != 0 && !accepting_) arm_accept();
+
+        for (; budget > 0 && !received_.empty() && writable(); --budget) {
+            emit(std::move(received_.front()));
+            received_.pop_front();
+            if (remaining_ > 0 && --remaining_ == 0) {
+                shut_down();
+                return;
+            }
+        }
+        if (received_.size() <= max_backlog_ / 2) {
+            for (connection* c : std::exchange(paused_, {})) arm_receive(*c);
+        }
+    }
+
+private:
+    struct acceptor : uring_operation {
+        void complete(int res, std::uint32_t flags) override { owner->accepted(res, flags); }
+        uring_tcp_input_source* owner = nullptr;
+    };
+
+    struct connection : uring_operation {
+        void complete(int res, std::uint32_t flags) override { owner->received(*this, res, flags); }
+        uring_tcp_input_source* owner = nullptr;
+        std::shared_ptr<tcp_connection> conn;
+        tcp_reassembly received;
+        bool pausing = false;
+    };
+
+    void arm_accept() {
+        listener_->watched_by(*driver_);
+        io_uring_sqe& sqe = driver_->prepare(IORING_OP_ACCEPT, listener_->fd(), &acceptor_);
+        sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        accepting_ = true;
+        hold();
+    }
+
+    void arm_receive(connection& c) {
+        c.conn->watched_by(*driver_);
+        io_uring_sqe& sqe = driver_->prepare(IORING_OP_RECV, c.conn->fd(), &c);
+        sqe.ioprio = IORING_RECV_MULTISHOT;
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = uring_driver::buffer_group();
+        c.pausing = false;
+        hold();
+    }
+
+    void accepted(int res, std::uint32_t flags) {
+        if (!(flags & IORING_CQE_F_MORE)) {
+            // Re-armed from step() unless the stage is done
+            accepting_ = false;
+            release();
+            notify();
+        }
+        if (res < 0) return;
+        auto c = std::make_unique<connection>();
+        c->owner = this;
+        c->conn = std::make_shared<tcp_connection>(res);
+        if (remaining_ == 0) return; // closed again with `c`
+        connection& ref = *c;
+        connections_.emplace(&ref, std::move(c));
+        arm_receive(ref);
+    }
+
+    void received(connection& c, int res, std::uint32_t flags) {
+        if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+            auto id = static_cast<std::uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            if (remaining_ != 0) {
+                c.received.append(driver_->buffer(id), static_cast<std::size_t>(res));
+                std::string data;
+                while (c.received.next(framer_, data)) received_.push_back(tcp_message{c.conn, std::move(data)});
+                notify();
+            }
+            driver_->recycle_buffer(id);
+            if ((flags & IORING_CQE_F_MORE) && received_.size() >= max_backlog_ && !c.pausing) {
+                c.pausing = true;
+                driver_->cancel(&c);
+            }
+        }
+        if (flags & IORING_CQE_F_MORE) return;
+
+        release();
+        if (remaining_ == 0 || (res <= 0 && res != -ECANCELED && res != -ENOBUFS)) {
+            // End of stream or error; replies in flight keep the connection alive
+            connections_.erase(&c);
+        } else if (res > 0 && !c.pausing) {
+            arm_receive(c);
+        } else {
+            // Paused, out of buffers, or the run ended: resumed from step()
+            paused_.push_back(&c);
+            notify();
+        }
+    }
+
+    // loop_count reached: stop accepting and receiving so the run can finish
+    void shut_down() {
+        received_.clear();
+        if (accepting_) driver_->cancel(&acceptor_);
+        for (auto& [c, owned] : connections_) driver_->cancel(c);
+        for (connection* c : std::exchange(paused_, {})) connections_.erase(c);
+    }
+
+    std::shared_ptr<tcp_connection> listener_;
+    tcp_framer framer_;
+    const std::size_t max_backlog_;
+    uring_driver* driver_ = nullptr;
+    acceptor acceptor_;
+    std::unordered_map<connection*, std::unique_ptr<connection>> connections_;
+    std::vector<connection*> paused_;
+    std::deque<tcp_message> received_;
+    int remaining_ = 0;
+    bool accepting_ = false;
+};
+
+// io_uring counterpart of tcp_output_sink: each reply is a sendmsg gathering its data and body,
+// linked to a shutdown of its connection unless it keeps the connection alive, queued without
+// a system call and submitted with the driver's next batch.
+// A short send breaks the link, so the rest is sent before the connection is shut down.
+// io_uring has no sendfile: a file body is sent with sendfile() on the loop thread once the
+// data is out, polling the ring for writability whenever the socket is full.
+// Replies on one connection are submitted one after the other, so they cannot interleave.
+class uring_tcp_output_sink : public node, public input_port<tcp_message> {
+public:
+    // Buffers passed to one sendmsg; more are sent with further requests
+    static constexpr int max_iov = 16;
+
+    explicit uring_tcp_output_sink(std::size_t max_in_flight = 1024) : max_in_flight_(max_in_flight) {}
+
+protected:
+    void place_inputs(std::size_t numa_node) override { this->place_input_links(numa_node); }
+
+    bool ready() const override { return this->readable() && in_flight_ < max_in_flight_; }
+
+    void step(std::size_t budget) override {
+        uring_driver& driver = uring_driver::require();
+        message<tcp_message> msg;
+        for (; budget > 0 && in_flight_ < max_in_flight_ && this->receive(msg); --budget) {
+            auto* r = new reply(this, msg.take());
+            ++in_flight_;
+            hold();
+            r->msg.connection->watched_by(driver); // closed after the requests on it
+            auto [it, idle] = busy_.try_emplace(r->msg.connection.get());
+            if (idle) {
+                proceed(driver, *r);
+            } else {
+                it->second.push_back(r); // sent once the replies before it are done
+            }
+        }
+        this->release_inputs();
+    }
+
+private:
+    struct reply;
+
+    // One of the two requests of a reply; `send` also waits for writability while a file is sent
+    struct part : uring_operation {
+        void complete(int res, std::uint32_t) override { r->owner->completed(*r, this == &r->send, res); }
+        reply* r = nullptr;
+    };
+
+    struct reply {
+        reply(uring_tcp_output_sink* owner, tcp_message msg)
+            : owner(owner), msg(std::move(msg)), cursor(this->msg) {
+            send.r = this;
+            shutdown.r = this;
+        }
+
+        uring_tcp_output_sink* owner;
+        tcp_message msg;
+        gather_cursor cursor;
+        msghdr hdr{};
+        iovec iov[max_iov];
+        off_t file_offset = 0;
+        int pending = 0;
+        bool failed = false;
+        bool shut = false;
+        bool linked = false; // the queued shutdown is linked to a send
+        part send;
+        part shutdown;
+    };
+
+    static bool file_left(const reply& r) {
+        return r.msg.file && static_cast<std::size_t>(r.file_offset) < r.msg.file->size();
+    }
+
+    static void queue_shutdown(uring_driver& driver, reply& r) {
+        io_uring_sqe& sqe = driver.prepare(IORING_OP_SHUTDOWN, r.msg.connection->fd(), &r.shutdown);
+        sqe.len = SHUT_RDWR;
+        ++r.pending;
+    }
+
+    // Queues the next requests of a reply, or finishes it once nothing is left to do
+    void proceed(uring_driver& driver, reply& r) {
+        int fd = r.msg.connection->fd();
+        if (!r.failed && !r.cursor.done()) {
+            int count = r.cursor.fill(r.iov, max_iov);
+            r.hdr.msg_iov = r.iov;
+            r.hdr.msg_iovlen = static_cast<std::size_t>(count);
+            io_uring_sqe& sqe = driver.prepare(IORING_OP_SENDMSG, fd, &r.send);
+            sqe.addr = reinterpret_cast<std::uint64_t>(&r.hdr);
+            sqe.msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (r.msg.file ? MSG_MORE : 0);
+            ++r.pending;
+            // The shutdown rides along if nothing else is to be sent
+            if (count < max_iov && !r.msg.file && !r.msg.keep_alive) {
+                sqe.flags = IOSQE_IO_LINK;
+                queue_shutdown(driver, r);
+                r.linked = true;
+            }
+            return;
+        }
+        if (!r.failed && file_left(r)) {
+            if (!send_file(fd, *r.msg.file, r.file_offset)) {
+                io_uring_sqe& sqe = driver.prepare(IORING_OP_POLL_ADD, fd, &r.send);
+                sqe.poll32_events = EPOLLOUT;
+                ++r.pending;
+                return;
+            }
+            r.failed = file_left(r); // the peer went away, or the file shrank
+        }
+        if ((!r.msg.keep_alive || r.failed) && !r.shut) {
+            queue_shutdown(driver, r);
+            return;
+        }
+        finish(driver, r);
+    }
+
+    void completed(reply& r, bool send, int res) {
+        if (send && res > 0) {
+            // A send, or the poll while the file is sent, which needs no accounting
+            if (!r.cursor.done()) r.cursor.advance(static_cast<std::size_t>(res));
+        } else if (send) {
+            r.failed = true;
+        } else {
+            // A linked shutdown is cancelled by a failed or short send: proceed() queues it again,
+            // alone or with the rest of the data. Otherwise it is done, or failed on a broken
+            // connection, or was cancelled by the end of the run.
+            if (res != -ECANCELED || !r.linked) r.shut = true;
+            r.linked = false;
+        }
+        if (--r.pending == 0) proceed(uring_driver::require(), r);
+    }
+
+    // Deletes a reply and starts the next one on its connection; if the connection was shut
+    // down or broke, the replies waiting for it are dropped
+    void finish(uring_driver& driver, reply& r) {
+        tcp_connection* conn = r.msg.connection.get();
+        bool open = r.msg.keep_alive && !r.failed;
+        done(r);
+
+        auto it = busy_.find(conn);
+        if (it->second.empty()) {
+            busy_.erase(it);
+        } else if (open) {
+            reply* next = it->second.front();
+            it->second.erase(it->second.begin());
+            proceed(driver, *next);
+        } else {
+            std::vector<reply*> dropped = std::move(it->second);
+            busy_.erase(it);
+            for (reply* d : dropped) done(*d);
+        }
+    }
+
+    void done(reply& r) {
+        delete &r;
+        if (in_flight_-- == max_in_flight_) notify();
+        release();
+    }
+
+    const std::size_t max_in_flight_;
+    std::size_t in_flight_ = 0;
+    // Connections with a reply in flight, and the replies waiting for it
+    std::unordered_map<tcp_connection*, std::vector<reply*>> busy_;
+};
+
+} // namespace pipef
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <uv.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include "reactor.h"
+#include "scheduler.h"
+
+namespace pipef {
+
+// Runs an engine on a libuv loop: `engine->run_on(driver, loop_count, duration_ms)`.
+// Every stage runs on the loop thread, descriptor waits become uv_poll handles and
+// duration_ms becomes a uv timer, so one thread multiplexes all I/O of the pipeline
+// and sources waiting on descriptors are never polled.
+// Not included by pipef.h, since it needs libuv.
+class uv_driver : public io_watcher {
+public:
+    explicit uv_driver(uv_loop_t* loop) : loop_(loop) {}
+
+    ~uv_driver() override {
+        cancel_all();
+        uv_run(loop_, UV_RUN_NOWAIT);
+    }
+
+    uv_driver(const uv_driver&) = delete;
+    uv_driver& operator=(const uv_driver&) = delete;
+
+    uv_loop_t* loop() const { return loop_; }
+
+    // Loop thread only, like the stages that call it
+    void watch(int fd, std::uint32_t events, io_handler* h) override {
+        auto& slot = entries_[fd];
+        if (!slot) {
+            slot = std::make_unique<entry>();
+            slot->driver = this;
+            slot->fd = fd;
+            int err = uv_poll_init(loop_, &slot->poll, fd);
+            if (err != 0) {
+                entries_.erase(fd);
+                throw std::system_error(-err, std::generic_category(), "uv_poll_init");
+            }
+            slot->poll.data = slot.get();
+        }
+        entry& e = *slot;
+        ((events & EPOLLIN) ? e.reader : e.writer) = h;
+        rearm(e);
+    }
+
+    void cancel(int fd) override {
+        auto it = entries_.find(fd);
+        if (it == entries_.end()) return;
+        entry* e = it->second.release();
+        entries_.erase(it);
+        io_handler* reader = std::exchange(e->reader, nullptr);
+        io_handler* writer = std::exchange(e->writer, nullptr);
+        uv_close(reinterpret_cast<uv_handle_t*>(&e->poll), [](uv_handle_t* h) {
+            delete static_cast<entry*>(h->data);
+        });
+        if (reader) reader->on_ready(EPOLLHUP);
+        if (writer) writer->on_ready(EPOLLHUP);
+    }
+
+    void unwatch(int fd, io_handler* h) override {
+        auto it = entries_.find(fd);
+        if (it == entries_.end()) return;
+        entry& e = *it->second;
+        if (e.reader == h) e.reader = nullptr;
+        if (e.writer == h) e.writer = nullptr;
+        rearm(e);
+    }
+
+    // Called by engine::run_on between scheduler begin() and finish()
+    void drive(scheduler& sched) {
+        sched_ = &sched;
+        io_watcher* outer = std::exchange(thread_override(), this);
+
+        uv_idle_init(loop_, &idle_);
+        idle_.data = this;
+        uv_async_init(loop_, &async_, [](uv_async_t* a) { static_cast<uv_driver*>(a->data)->run_tasks_soon(); });
+        async_.data = this;
+        uv_timer_init(loop_, &timer_);
+        timer_.data = this;
+
+        sched.set_waker([this] { uv_async_send(&async_); });
+        if (sched.deadline() != std::chrono::steady_clock::time_point::max()) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                sched.deadline() - std::chrono::steady_clock::now());
+            uv_timer_start(&timer_, [](uv_timer_t* t) { uv_stop(t->loop); },
+                           left.count() > 0 ? static_cast<std::uint64_t>(left.count()) : 0, 0);
+        }
+        run_tasks_soon();
+
+        uv_run(loop_, UV_RUN_DEFAULT);
+
+        // Parked watches are woken as cancelled, so no handle outlives this run
+        sched.set_waker({});
+        cancel_all();
+        uv_close(reinterpret_cast<uv_handle_t*>(&idle_), nullptr);
+        uv_close(reinterpret_cast<uv_handle_t*>(&async_), nullptr);
+        uv_close(reinterpret_cast<uv_handle_t*>(&timer_), nullptr);
+        uv_run(loop_, UV_RUN_NOWAIT);
+
+        thread_override() = outer;
+        sched_ = nullptr;
+    }
+
+private:
+    struct entry {
+        uv_poll_t poll;
+        uv_driver* driver = nullptr;
+        int fd = -1;
+        io_handler* reader = nullptr;
+        io_handler* writer = nullptr;
+    };
+
+    // Polls for whichever of reader and writer are pending
+    void rearm(entry& e) {
+        int events = (e.reader ? UV_READABLE | UV_DISCONNECT : 0) | (e.writer ? UV_WRITABLE : 0);
+        if (events == 0) {
+            uv_poll_stop(&e.poll);
+            return;
+        }
+        int err = uv_poll_start(&e.poll, events, [](uv_poll_t* p, int status, int ready) {
+            auto* e = static_cast<entry*>(p->data);
+            e->driver->dispatch(*e, status, ready);
+        });
+        if (err != 0) throw std::system_error(-err, std::generic_category(), "uv_poll_start");
+    }
+
+    void dispatch(entry& e, int status, int ready) {
+        std::uint32_t events = status < 0 ? static_cast<std::uint32_t>(EPOLLERR) : 0u;
+        if (ready & UV_READABLE) events |= EPOLLIN;
+        if (ready & UV_DISCONNECT) events |= EPOLLRDHUP;
+        if (ready & UV_WRITABLE) events |= EPOLLOUT;
+
+        bool failed = status < 0;
+        io_handler* reader = nullptr;
+        io_handler* writer = nullptr;
+        if (e.reader && (failed || (events & (EPOLLIN | EPOLLRDHUP)))) reader = std::exchange(e.reader, nullptr);
+        if (e.writer && (failed || (events & EPOLLOUT))) writer = std::exchange(e.writer, nullptr);
+        rearm(e);
+
+        // Handlers may watch or cancel this descriptor again
+        if (reader) reader->on_ready(events);
+        if (writer) writer->on_ready(events);
+        run_tasks_soon();
+    }
+
+    void run_tasks_soon() {
+        if (!uv_is_active(reinterpret_cast<uv_handle_t*>(&idle_))) {
+            uv_idle_start(&idle_, [](uv_idle_t* i) { static_cast<uv_driver*>(i->data)->run_tasks(); });
+        }
+    }
+
+    // One scheduler batch per loop iteration, so descriptor events are not starved
+    void run_tasks() {
+        std::size_t ran = sched_->poll(scheduler::task_budget);
+        if (sched_->finished()) {
+            uv_stop(loop_);
+        } else if (ran == 0) {
+            uv_idle_stop(&idle_);
+        }
+    }
+
+    void cancel_all() {
+        while (!entries_.empty()) cancel(entries_.begin()->first);
+    }
+
+    uv_loop_t* loop_;
+    scheduler* sched_ = nullptr;
+    uv_idle_t idle_;
+    uv_async_t async_;
+    uv_timer_t timer_;
+    std::unordered_map<int, std::unique_ptr<entry>> entries_;
+};
+
+} // namespace pipef
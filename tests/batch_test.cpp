@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <thread>
+
+#include "check.h"
+#include "pipef.h"
+
+using namespace pipef;
+
+// With a deep backlog, batches grow past the scheduler's step budget up to max_batch
+void test_batch_grows_to_max() {
+    for (std::size_t workers : {1, 2}) {
+        auto e = engine::create(workers);
+        const int total = 200000;
+        int next = 0;
+        std::size_t largest_fill = 0;
+        auto src = e->create<source<std::span<int>>>([&](std::span<int> out) {
+            largest_fill = std::max(largest_fill, out.size());
+            std::size_t n = 0;
+            for (; n < out.size() && next < total; ++n) out[n] = next++;
+            return n;
+        });
+
+        std::size_t largest_batch = 0;
+        int expected = 0;
+        auto snk = e->create<sink<std::span<int>>>([&](std::span<int> batch) {
+            largest_batch = std::max(largest_batch, batch.size());
+            for (int x : batch) PIPEF_CHECK(x == expected++);
+            if (batch.size() < 64) std::this_thread::sleep_for(std::chrono::microseconds(50));
+        });
+        src | bounded(4096) | snk;
+        e->run();
+
+        PIPEF_CHECK(expected == total);
+        PIPEF_CHECK(largest_fill == batch_sizer::default_max);
+        PIPEF_CHECK(largest_batch == batch_sizer::default_max);
+    }
+}
+
+// A smaller max_batch caps the batch size
+void test_batch_max() {
+    auto e = engine::create(1);
+    int next = 0;
+    std::size_t largest = 0;
+    auto src = e->create<source<std::span<int>>>(
+        [&](std::span<int> out) {
+            largest = std::max(largest, out.size());
+            std::size_t n = 0;
+            for (; n < out.size() && next < 10000; ++n) out[n] = next++;
+            return n;
+        },
+        16);
+    auto snk = e->create<sink<int>>([](int) {});
+    src | snk;
+    e->run();
+    PIPEF_CHECK(largest == 16);
+}
+
+int main() {
+    test_batch_grows_to_max();
+    test_batch_max();
+}
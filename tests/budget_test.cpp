@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "pipef.h"
+
+using namespace pipef;
+
+// Everything charged to the budget is credited back once the pipeline has drained,
+// and producers pause rather than overshoot it by more than one item per link
+void test_budget_drains() {
+    for (std::size_t workers : {1, 2}) {
+        const std::size_t limit = 1 << 20;
+        auto e = engine::create(workers, limit);
+        int produced = 0;
+        std::size_t peak = 0;
+        auto src = e->create<source<std::vector<char>>>([&]() -> std::optional<std::vector<char>> {
+            if (produced == 200) return std::nullopt;
+            ++produced;
+            peak = std::max(peak, e->in_flight_bytes());
+            return std::vector<char>(100000);
+        });
+        auto resize = e->create<transformer<std::vector<char>>>([](std::vector<char> v) {
+            v.resize(50000);
+            v.shrink_to_fit();
+            return v;
+        });
+        std::size_t received = 0;
+        auto snk = e->create<sink<std::vector<char>>>([&](std::vector<char> v) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            received += v.size();
+        });
+        src | bounded(64) | resize | bounded(64) | snk;
+        e->run();
+        PIPEF_CHECK(received == 200 * 50000);
+        PIPEF_CHECK(peak < limit + 2 * 100000 + 4096);
+        PIPEF_CHECK(e->in_flight_bytes() == 0);
+    }
+}
+
+// Items discarded by lossy links are credited too
+void test_budget_drops() {
+    auto e = engine::create(2, 1 << 20);
+    int produced = 0;
+    auto src = e->create<source<std::string>>([&]() -> std::optional<std::string> {
+        if (produced == 5000) return std::nullopt;
+        ++produced;
+        return std::string(1000, 'x');
+    });
+    auto snk = e->create<sink<std::string>>([](const std::string&) {
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+    });
+    src | bounded(16, overflow::drop_oldest) | snk;
+    e->run();
+    PIPEF_CHECK(e->in_flight_bytes() == 0);
+}
+
+// A fanned-out item is charged once, not once per branch, and credited when the last branch is done
+void test_budget_fan_out() {
+    auto e = engine::create(1, std::size_t(1) << 30);
+    int produced = 0;
+    auto src = e->create<source<std::vector<char>>>([&]() -> std::optional<std::vector<char>> {
+        if (produced == 10) return std::nullopt;
+        ++produced;
+        return std::vector<char>(100000);
+    });
+    // One worker: the source emits all ten items before any sink runs
+    std::size_t first_seen = 0;
+    std::vector<std::shared_ptr<sink<std::vector<char>>>> sinks;
+    for (int i = 0; i < 3; ++i) {
+        sinks.push_back(e->create<sink<std::vector<char>>>([&](const std::vector<char>&) {
+            if (first_seen == 0) first_seen = e->in_flight_bytes();
+        }));
+        src | sinks.back();
+    }
+    e->run();
+    PIPEF_CHECK(first_seen >= 10 * 100000);
+    PIPEF_CHECK(first_seen < 11 * 100000);
+    PIPEF_CHECK(e->in_flight_bytes() == 0);
+}
+
+// Same for envelopes, which every branch gets its own handle to
+void test_budget_envelope_fan_out() {
+    auto e = engine::create(1, std::size_t(1) << 30);
+    int produced = 0;
+    auto src = e->create<source<envelope<std::vector<char>>>>([&]() -> std::optional<envelope<std::vector<char>>> {
+        if (produced == 10) return std::nullopt;
+        ++produced;
+        return make_envelope<std::vector<char>>(100000);
+    });
+    std::size_t first_seen = 0;
+    std::vector<std::shared_ptr<sink<envelope<std::vector<char>>>>> sinks;
+    for (int i = 0; i < 3; ++i) {
+        sinks.push_back(e->create<sink<envelope<std::vector<char>>>>([&](envelope<std::vector<char>>) {
+            if (first_seen == 0) first_seen = e->in_flight_bytes();
+        }));
+        src | sinks.back();
+    }
+    e->run();
+    // The first sink may be the one holding the charged handle, already credited for its item
+    PIPEF_CHECK(first_seen >= 9 * 100000);
+    PIPEF_CHECK(first_seen < 11 * 100000);
+    PIPEF_CHECK(e->in_flight_bytes() == 0);
+}
+
+// Results waiting in a parallel transformer's replicas count against the budget too,
+// so the source cannot run far ahead of a slow sink
+void test_budget_parallel() {
+    auto e = engine::create(2, 1 << 20);
+    int produced = 0;
+    int consumed = 0;
+    int lag = 0;
+    auto src = e->create<source<std::vector<char>>>([&]() -> std::optional<std::vector<char>> {
+        if (produced == 2000) return std::nullopt;
+        ++produced;
+        return std::vector<char>(100000);
+    });
+    auto relay = e->create<transformer<std::vector<char>, std::vector<char>>>([](std::vector<char> v) {
+        v.push_back(0);
+        return v;
+    });
+    relay->parallel(2);
+    auto snk = e->create<sink<std::vector<char>>>([&](std::vector<char>) {
+        lag = std::max(lag, produced - consumed++);
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+    });
+    src | relay | snk;
+    e->run();
+    PIPEF_CHECK(consumed == 2000);
+    PIPEF_CHECK(lag < 16);
+    PIPEF_CHECK(e->in_flight_bytes() == 0);
+}
+
+int main() {
+    test_budget_drains();
+    test_budget_drops();
+    test_budget_fan_out();
+    test_budget_envelope_fan_out();
+    test_budget_parallel();
+}
@@ -0,0 +1,65 @@
+#include <chrono>
+#include <optional>
+#include <thread>
+
+#include "check.h"
+#include "pipef.h"
+
+using namespace pipef;
+
+// Every item a lossy link does not deliver is counted as dropped, and survivors keep their order
+void test_drop_policies() {
+    for (auto options : {bounded(8, overflow::drop_oldest), bounded(8, overflow::drop_newest), sampled(8, 4)}) {
+        for (std::size_t workers : {1, 3}) {
+            auto e = engine::create(workers);
+            int next = 0;
+            long delivered = 0;
+            int last = -1;
+            auto src = e->create<source<int>>([&]() -> std::optional<int> {
+                if (next == 20000) return std::nullopt;
+                return next++;
+            });
+            auto snk = e->create<sink<int>>([&](int x) {
+                PIPEF_CHECK(x > last);
+                last = x;
+                ++delivered;
+                if (x % 16 == 0) std::this_thread::sleep_for(std::chrono::microseconds(1));
+            });
+            src | options | snk;
+            e->run();
+            auto stats = src->output_links()[0]->stats();
+            PIPEF_CHECK(delivered + static_cast<long>(stats.dropped) == 20000);
+            PIPEF_CHECK(delivered > 0);
+        }
+    }
+}
+
+// The producer never stalls on a spilling link, and spilled items come back in order
+void test_spill_order() {
+    for (std::size_t workers : {1, 2}) {
+        auto e = engine::create(workers);
+        int next = 0;
+        int expected = 0;
+        auto src = e->create<source<int>>([&]() -> std::optional<int> {
+            if (next == 20000) return std::nullopt;
+            return next++;
+        });
+        auto snk = e->create<sink<int>>([&](int x) {
+            PIPEF_CHECK(x == expected);
+            ++expected;
+            if (x % 256 == 0) std::this_thread::sleep_for(std::chrono::microseconds(100));
+        });
+        src | spilled(16) | snk;
+        e->run();
+        auto stats = src->output_links()[0]->stats();
+        PIPEF_CHECK(expected == 20000);
+        PIPEF_CHECK(stats.spilled > 0);
+        PIPEF_CHECK(stats.blocked == 0);
+        PIPEF_CHECK(stats.dropped == 0);
+    }
+}
+
+int main() {
+    test_drop_policies();
+    test_spill_order();
+}
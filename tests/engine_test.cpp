@@ -0,0 +1,69 @@
+#include <chrono>
+#include <optional>
+
+#include "check.h"
+#include "pipef.h"
+
+using namespace pipef;
+
+// Items reach the sink in source order however many workers run the stages
+void test_ordering() {
+    for (std::size_t workers : {1, 2, 4}) {
+        auto e = engine::create(workers);
+        int next = 0;
+        int expected = 0;
+        auto src = e->create<source<int>>([&]() -> std::optional<int> {
+            if (next == 50000) return std::nullopt;
+            return next++;
+        });
+        auto twice = e->create<transformer<int>>([](int x) { return x * 2; });
+        auto snk = e->create<sink<int>>([&](int x) {
+            PIPEF_CHECK(x == expected * 2);
+            ++expected;
+        });
+        src | bounded(64) | twice | bounded(64) | snk;
+        e->run();
+        PIPEF_CHECK(expected == 50000);
+    }
+}
+
+// A source that never ends stops after loop_count items
+void test_loop_count() {
+    for (std::size_t workers : {1, 2}) {
+        auto e = engine::create(workers);
+        int next = 0;
+        int received = 0;
+        auto src = e->create<source<int>>([&]() -> std::optional<int> { return next++; });
+        auto snk = e->create<sink<int>>([&](int) { ++received; });
+        src | snk;
+        e->run(1000);
+        PIPEF_CHECK(received == 1000);
+        PIPEF_CHECK(next == 1000);
+
+        // A second run starts the count afresh
+        e->run(10);
+        PIPEF_CHECK(received == 1010);
+    }
+}
+
+// A source that never ends stops at the deadline
+void test_deadline() {
+    auto e = engine::create(2);
+    long received = 0;
+    auto src = e->create<source<int>>([]() -> std::optional<int> { return 1; });
+    auto snk = e->create<sink<int>>([&](int) { ++received; });
+    src | snk;
+
+    auto begin = std::chrono::steady_clock::now();
+    e->run(INFINITE, 100);
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    PIPEF_CHECK(elapsed >= std::chrono::milliseconds(100));
+    PIPEF_CHECK(elapsed < std::chrono::seconds(5));
+    PIPEF_CHECK(received > 0);
+}
+
+int main() {
+    test_ordering();
+    test_loop_count();
+    test_deadline();
+}
@@ -0,0 +1,60 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "pipef.h"
+
+using namespace pipef;
+
+std::vector<std::string> read_lines(int fd, int duration_ms) {
+    auto e = engine::create(2);
+    auto src = e->create<key_input_src>(fd);
+    std::vector<std::string> lines;
+    auto snk = e->create<sink<std::string>>([&](std::string line) { lines.push_back(std::move(line)); });
+    src | snk;
+    e->run(INFINITE, duration_ms);
+    return lines;
+}
+
+// Lines written to a pipe over time arrive, and the descriptor's flags are left alone
+void test_pipe() {
+    int p[2];
+    PIPEF_CHECK(::pipe(p) == 0);
+    int flags = ::fcntl(p[0], F_GETFL);
+    std::thread writer([&] {
+        PIPEF_CHECK(::write(p[1], "one\ntw", 6) == 6);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        PIPEF_CHECK(::fcntl(p[0], F_GETFL) == flags);
+        PIPEF_CHECK(::write(p[1], "o\nthree", 7) == 7);
+        ::close(p[1]);
+    });
+    auto lines = read_lines(p[0], 5000);
+    writer.join();
+    PIPEF_CHECK((lines == std::vector<std::string>{"one", "two", "three"}));
+    PIPEF_CHECK(::fcntl(p[0], F_GETFL) == flags);
+    ::close(p[0]);
+}
+
+// A regular file, e.g. stdin redirected from one, cannot be waited on but is always readable
+void test_file() {
+    char path[] = "/tmp/pipef-io-XXXXXX";
+    int fd = ::mkstemp(path);
+    PIPEF_CHECK(fd >= 0);
+    PIPEF_CHECK(::write(fd, "a\nb\n", 4) == 4);
+    PIPEF_CHECK(::lseek(fd, 0, SEEK_SET) == 0);
+    auto lines = read_lines(fd, 5000);
+    PIPEF_CHECK((lines == std::vector<std::string>{"a", "b"}));
+    ::close(fd);
+    ::unlink(path);
+}
+
+int main() {
+    test_pipe();
+    test_file();
+}
@@ -0,0 +1,89 @@
+#include <sched.h>
+#include <stdlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "pipef.h"
+
+using namespace pipef;
+
+namespace fs = std::filesystem;
+
+// Writes a fake sysfs node directory with the given cpulist per node id
+fs::path fake_sysfs(const std::vector<std::pair<int, std::string>>& nodes) {
+    std::string pattern = (fs::temp_directory_path() / "pipef-numa-XXXXXX").string();
+    PIPEF_CHECK(::mkdtemp(pattern.data()) != nullptr);
+    fs::path root(pattern);
+    for (const auto& [id, cpulist] : nodes) {
+        fs::create_directory(root / ("node" + std::to_string(id)));
+        std::ofstream(root / ("node" + std::to_string(id)) / "cpulist") << cpulist << "\n";
+    }
+    return root;
+}
+
+// Ranges are expanded, memory-only nodes skipped and missing ids tolerated
+void test_parse() {
+    fs::path root = fake_sysfs({{0, "0-3,8-11"}, {1, ""}, {3, "4-7,12"}});
+    numa_topology topology(root.string());
+    PIPEF_CHECK(topology.nodes() == 2);
+    PIPEF_CHECK((topology.cpus(0) == std::vector<int>{0, 1, 2, 3, 8, 9, 10, 11}));
+    PIPEF_CHECK((topology.cpus(1) == std::vector<int>{4, 5, 6, 7, 12}));
+    fs::remove_all(root);
+
+    // Without node directories the machine is one node with every CPU
+    fs::path empty = fake_sysfs({});
+    numa_topology flat(empty.string());
+    PIPEF_CHECK(flat.nodes() == 1);
+    PIPEF_CHECK(!flat.cpus(0).empty());
+    fs::remove_all(empty);
+}
+
+struct probe {
+    char bytes[40];
+};
+
+// Slots released by a thread bound to one node are reused on that node only
+void test_pool_per_node() {
+    // Both fake nodes hold the CPU we run on, so binding to either succeeds
+    std::string cpu = std::to_string(::sched_getcpu());
+    fs::path root = fake_sysfs({{0, cpu}, {1, cpu}});
+    numa_topology topology(root.string());
+    PIPEF_CHECK(topology.nodes() == 2);
+
+    const std::size_t count = 4 * slab_pool<probe>::cache_limit;
+    std::set<void*> released;
+    std::thread([&] {
+        PIPEF_CHECK(topology.bind_thread(1));
+        PIPEF_CHECK(numa_topology::current_node() == 1);
+        std::vector<void*> slots;
+        for (std::size_t i = 0; i < count; ++i) slots.push_back(slab_pool<probe>::instance().allocate());
+        for (void* p : slots) {
+            slab_pool<probe>::instance().deallocate(p);
+            released.insert(p);
+        }
+    }).join(); // the thread's cache goes to node 1's list on exit
+
+    auto allocate_on = [&](std::size_t node) {
+        std::vector<void*> slots;
+        std::thread([&] {
+            PIPEF_CHECK(topology.bind_thread(node));
+            for (std::size_t i = 0; i < count; ++i) slots.push_back(slab_pool<probe>::instance().allocate());
+        }).join();
+        return slots;
+    };
+
+    for (void* p : allocate_on(0)) PIPEF_CHECK(!released.count(p));
+    for (void* p : allocate_on(1)) PIPEF_CHECK(released.count(p));
+    fs::remove_all(root);
+}
+
+int main() {
+    test_parse();
+    test_pool_per_node();
+}
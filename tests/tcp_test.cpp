@@ -0,0 +1,78 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "check.h"
+#include "pipef.h"
+
+using namespace pipef;
+
+int connect_to(unsigned short port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    PIPEF_CHECK(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+    return fd;
+}
+
+// A connection nothing waited on is closed directly, without starting the reactor
+void test_close_unwatched() {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    { tcp_connection conn(fd); }
+    PIPEF_CHECK(::fcntl(fd, F_GETFD) == -1 && errno == EBADF);
+    PIPEF_CHECK(reactor::existing() == nullptr);
+}
+
+// A quiet connection is closed after the idle timeout; one that keeps sending stays open
+void test_idle_timeout() {
+    using namespace std::chrono;
+    auto e = engine::create(2);
+    auto src = e->create<tcp_input_source>(0);
+    src->idle_timeout(milliseconds(100));
+    int received = 0;
+    auto snk = e->create<sink<tcp_message>>([&](const tcp_message&) { ++received; });
+    src | snk;
+
+    steady_clock::duration quiet_open{};
+    bool busy_open = false;
+    std::thread client([&, port = src->port()] {
+        auto begin = steady_clock::now();
+        int quiet = connect_to(port);
+        int busy = connect_to(port);
+        std::thread reader([&] {
+            char c;
+            PIPEF_CHECK(::read(quiet, &c, 1) == 0);
+            quiet_open = steady_clock::now() - begin;
+        });
+        for (int i = 0; i < 10; ++i) {
+            PIPEF_CHECK(::send(busy, "x", 1, MSG_NOSIGNAL) == 1);
+            std::this_thread::sleep_for(milliseconds(40));
+        }
+        char c;
+        busy_open = ::recv(busy, &c, 1, MSG_DONTWAIT) < 0 && errno == EAGAIN;
+        reader.join();
+        ::close(quiet);
+        ::close(busy);
+    });
+    e->run(INFINITE, 1500);
+    client.join();
+
+    PIPEF_CHECK(received > 0);
+    PIPEF_CHECK(busy_open);
+    PIPEF_CHECK(quiet_open >= milliseconds(100));
+    PIPEF_CHECK(quiet_open < milliseconds(300));
+}
+
+int main() {
+    test_close_unwatched();
+    test_idle_timeout();
+}